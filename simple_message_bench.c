@@ -0,0 +1,924 @@
+/**
+ * @file simple_message_bench.c
+ *
+ * VCS TCP/IP Client and Server - micro benchmarks of the protocol hot paths (make bench)
+ *
+ * Runs check_stream(), the receive_response() state machine over synthetic responses,
+ * send_message() and the accept-to-spawn path of a server started with a stand-in
+ * business logic, over TCP loopback and over a unix domain socket. The benchmarks are run in several rounds, so a burst of load on the
+ * host only hits some runs of a benchmark, and the median run is reported as
+ * nanoseconds per operation in a JSON file, one benchmark per line, together with its
+ * standard error. If a baseline of an earlier run is given, benchmarks slower than the
+ * threshold plus twice the error of the comparison make the run fail.
+ *
+ * @author: Claudia Baierl - ic14b003 <ic14b003@technikum-wien.at>
+ * @author: Zuebide Sayici - ic14b002 <ic14b002@technikum-wien.at>
+ *
+ * @version $Revision: 1 $
+ *
+ * Last Modified: $Author: Claudia Baierl $
+ */
+
+/*
+ * ----------------------------- includes -------------------------
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "simple_message_socket.h"
+
+/*
+ * ---------------------------------- defines ------------------------
+ */
+
+/* rounds over all benchmarks and runs of each benchmark per round, the median run counts */
+#define BENCH_ROUNDS 3
+#define BENCH_REPEAT 5
+#define BENCH_RUNS (BENCH_ROUNDS * BENCH_REPEAT)
+#define BENCH_MAX 16
+#define BENCH_NAME_SIZE 64
+/* iterations of each benchmark */
+#define CHECK_STREAM_ITERATIONS 1000000UL
+#define SEND_MESSAGE_ITERATIONS 10000UL
+#define ACCEPT_ITERATIONS 200UL
+/* receive_response() reads about this many bytes per size */
+#define RECEIVE_BYTES (64UL * 1024 * 1024)
+/* message of the send_message() and accept-to-spawn benchmarks */
+#define MESSAGE_SIZE 1024
+/* default slowdown in percent that counts as regression */
+#define THRESHOLD_DEFAULT 10.0
+/* time the stand-in server gets to start listening, and how often a server on a
+ * chosen port is started (another program may take the port in between) */
+#define SERVER_START_MS 10000
+#define SERVER_START_ATTEMPTS 3
+#define SERVER_POLL_MS 10
+/* work directory of the benchmarks, /tmp if this is no tmpfs */
+#define BENCH_TMPFS "/dev/shm"
+/* unix domain socket of the stand-in server, in the work directory */
+#define BENCH_SOCKET "bench.sock"
+#define NS_PER_S 1000000000LL
+
+/*
+ * ---------------------------------- typedefs -----------------------
+ */
+
+struct bench_result
+{
+	char name[BENCH_NAME_SIZE];
+	unsigned long iterations;
+	double ns_per_op;
+	/* standard error of the median in percent, estimated from the spread of the runs */
+	double median_error_percent;
+	/* time of each run in nanoseconds */
+	long long runs[BENCH_RUNS];
+	int run_count;
+};
+
+/*
+ * ---------------------------------- globals ------------------------
+ */
+
+/* defined by simple_message_client.c */
+extern const char *prg_name;
+
+/*
+ * ---------------------------------- function prototypes ------------
+ */
+
+/* client functions under test (simple_message_client.c built with SMC_BENCH) */
+int check_stream(char *stream, const char *lookup, char *value);
+int receive_response(int socket_desc);
+int send_message(int socket_desc, const char *user, const char *message, const char *image);
+
+static void bench_usage(FILE *out, int exit_status);
+long long now_ns(void);
+int compare_runs(const void *left, const void *right);
+void summarize_runs(struct bench_result *result);
+int bench_check_stream(struct bench_result *result);
+int bench_receive_response(struct bench_result *result, size_t file_size);
+int bench_send_message(struct bench_result *result);
+int bench_accept_to_spawn(struct bench_result *result, const char *server, const char *port, const char *name);
+int free_port(const char *wanted, char *port, size_t size);
+pid_t start_server(const char *server, const char *port, struct sockaddr_storage *address, socklen_t *address_length);
+int write_json(const char *path, const struct bench_result *results, size_t count);
+int compare_baseline(const char *path, const struct bench_result *results, size_t count, double threshold);
+
+
+/**
+ *
+ * \brief Main function runs the benchmarks, writes the results and compares them with the baseline
+ *
+ * \param argc passes the number of arguments
+ * \param argv passes the arguments (programme name is argv[0])
+ *
+ * \return EXIT_SUCCESS if all benchmarks ran and none regressed
+ * \return EXIT_FAILURE otherwise
+ *
+ */
+int main(int argc, char *argv[])
+{
+	static const size_t receive_sizes[] = { 256, 4096, 65536, 1048576 };
+	struct option long_options[] =
+	{
+		{"output", 1, NULL, 'o'},
+		{"baseline", 1, NULL, 'b'},
+		{"threshold", 1, NULL, 't'},
+		{"server", 1, NULL, 's'},
+		{"port", 1, NULL, 'p'},
+		{"help", 0, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct bench_result results[BENCH_MAX];
+	char work_directory[PATH_MAX];
+	char unix_endpoint[PATH_MAX + sizeof(SMS_UNIX_PREFIX) + sizeof(BENCH_SOCKET)];
+	struct statfs file_system;
+	char start_directory[PATH_MAX];
+	char server_path[PATH_MAX];
+	const char *output_path = NULL;
+	const char *baseline_path = NULL;
+	const char *server = NULL;
+	/* 0 lets the benchmark choose a free port */
+	const char *port = "0";
+	char *end_ptr;
+	double threshold = THRESHOLD_DEFAULT;
+	size_t count = 0;
+	int round;
+	size_t i;
+	int failed = 0;
+	int option;
+
+	prg_name = argv[0];
+
+	while((option = getopt_long(argc, argv, "o:b:t:s:p:h", long_options, NULL)) != -1)
+	{
+		switch(option)
+		{
+		case 'o':
+			output_path = optarg;
+			break;
+		case 'b':
+			baseline_path = optarg;
+			break;
+		case 't':
+			threshold = strtod(optarg, &end_ptr);
+			if(*optarg == '\0' || *end_ptr != '\0' || threshold < 0)
+			{
+				bench_usage(stderr, EXIT_FAILURE);
+			}
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'h':
+			bench_usage(stdout, EXIT_SUCCESS);
+			break;
+		default:
+			bench_usage(stderr, EXIT_FAILURE);
+		}
+	}
+	if(optind != argc)
+	{
+		bench_usage(stderr, EXIT_FAILURE);
+	}
+
+	/* the server is started from the work directory */
+	if(server != NULL)
+	{
+		if(realpath(server, server_path) == NULL)
+		{
+			fprintf(stderr, "%s: server %s - %s\n", prg_name, server, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		server = server_path;
+	}
+
+	/* the stand-in server and receive_response() write files - keep them out of the source tree,
+	 * and on a tmpfs if there is one, so receive_response() is not measured by the disk */
+	snprintf(work_directory, sizeof(work_directory), "%s/smc_bench.XXXXXX",
+			(statfs(BENCH_TMPFS, &file_system) == 0 && file_system.f_type == TMPFS_MAGIC) ? BENCH_TMPFS : "/tmp");
+	if(getcwd(start_directory, sizeof(start_directory)) == NULL || mkdtemp(work_directory) == NULL
+			|| chdir(work_directory) == -1)
+	{
+		fprintf(stderr, "%s: cannot create work directory - %s\n", prg_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	snprintf(unix_endpoint, sizeof(unix_endpoint), "%s%s/%s", SMS_UNIX_PREFIX, work_directory, BENCH_SOCKET);
+	/* closed sockets of the benchmarks must not kill the benchmark */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(results, 0, sizeof(results));
+	for(round = 0; round < BENCH_ROUNDS && !failed; round++)
+	{
+		count = 0;
+		failed |= bench_check_stream(&results[count++]);
+		for(i = 0; i < sizeof(receive_sizes) / sizeof(receive_sizes[0]); i++)
+		{
+			failed |= bench_receive_response(&results[count++], receive_sizes[i]);
+		}
+		failed |= bench_send_message(&results[count++]);
+		if(server != NULL)
+		{
+			failed |= bench_accept_to_spawn(&results[count++], server, port, "accept_to_spawn");
+			failed |= bench_accept_to_spawn(&results[count++], server, unix_endpoint, "accept_to_spawn_unix");
+		}
+	}
+
+	if(chdir(start_directory) == -1 || rmdir(work_directory) == -1)
+	{
+		fprintf(stderr, "%s: cannot remove %s - %s\n", prg_name, work_directory, strerror(errno));
+	}
+	if(failed)
+	{
+		return EXIT_FAILURE;
+	}
+
+	/* stdout may carry the JSON results */
+	for(i = 0; i < count; i++)
+	{
+		summarize_runs(&results[i]);
+		fprintf(stderr, "%-28s %12.1f ns/op +-%5.1f%% (%lu iterations)\n", results[i].name, results[i].ns_per_op,
+				results[i].median_error_percent, results[i].iterations);
+	}
+	if(write_json(output_path, results, count) == -1)
+	{
+		return EXIT_FAILURE;
+	}
+	if(baseline_path != NULL && compare_baseline(baseline_path, results, count, threshold) != 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ *
+ * \brief bench_usage function prints the usage of the benchmark and exits
+ *
+ * \param out passes whether output is to stdout or stderr
+ * \param exit_status passes the status in which the programme exits
+ *
+ */
+static void bench_usage(FILE *out, int exit_status)
+{
+	fprintf(out, "usage: %s <options>\n"
+			"\t-o, \t--output <file>\t\tJSON results (default stdout)\n"
+			"\t-b, \t--baseline <file>\tcompare with the results of an earlier run\n"
+			"\t-t, \t--threshold <percent>\tslowdown that fails the run (default %.0f)\n"
+			"\t-s, \t--server <binary>\tbenchmark accept-to-spawn of this server\n"
+			"\t-p, \t--port <port>\t\tloopback port of the server (default 0: a free port),\n"
+			"\t\t\t\t\tthe server is measured on a unix socket as well\n"
+			"\t-h, \t--help\n", prg_name, THRESHOLD_DEFAULT);
+	fflush(out);
+	exit(exit_status);
+}
+/**
+ *
+ * \brief now_ns function returns the monotonic clock in nanoseconds
+ *
+ */
+long long now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long) now.tv_sec * NS_PER_S + now.tv_nsec;
+}
+/**
+ *
+ * \brief compare_runs function compares the times of two runs for qsort()
+ *
+ * \param left passes the first time
+ * \param right passes the second time
+ *
+ * \return <0, 0 or >0 like strcmp()
+ *
+ */
+int compare_runs(const void *left, const void *right)
+{
+	long long a = *(const long long *) left;
+	long long b = *(const long long *) right;
+
+	return (a > b) - (a < b);
+}
+/**
+ *
+ * \brief summarize_runs function reports the median of the runs of a benchmark and its standard error
+ *
+ * The fastest run is not used, it only shows how fast a run can be when nothing else
+ * happens on the host, and the slowest ones mostly show other load. The standard error
+ * of the median is estimated from the interquartile range (IQR / 1.349 for the standard
+ * deviation, times 1.2533 / sqrt(runs)); it tells compare_baseline() how far the
+ * median moves between runs without any change of the code.
+ *
+ * \param result passes the runs (sorted in place) and returns the median and its error
+ *
+ */
+void summarize_runs(struct bench_result *result)
+{
+	long long *runs = result->runs;
+	int count = result->run_count;
+	double median;
+
+	result->ns_per_op = 0;
+	result->median_error_percent = 0;
+	if(count == 0)
+	{
+		return;
+	}
+
+	qsort(runs, (size_t) count, sizeof(*runs), compare_runs);
+	median = (count % 2 == 1) ? (double) runs[count / 2] : ((double) runs[count / 2 - 1] + (double) runs[count / 2]) / 2;
+	result->ns_per_op = median / (double) result->iterations;
+	if(median > 0)
+	{
+		result->median_error_percent = (double) (runs[(3 * count) / 4] - runs[count / 4]) / 1.349 * 1.2533
+				/ sqrt((double) count) / median * 100.0;
+	}
+}
+/**
+ *
+ * \brief bench_check_stream function measures the lookup of a record value in a response line
+ *
+ * \param result passes the result, the runs of this round are added
+ *
+ * \return 0 when no error occurs
+ * \return 1 on error
+ *
+ */
+int bench_check_stream(struct bench_result *result)
+{
+	char line[] = "len=1048576\n";
+	char value[2048];
+	unsigned long i;
+	long long start;
+	int repeat;
+	int found = 0;
+
+	for(repeat = 0; repeat < BENCH_REPEAT; repeat++)
+	{
+		start = now_ns();
+		for(i = 0; i < CHECK_STREAM_ITERATIONS; i++)
+		{
+			found += (check_stream(line, "len=", value) == 0);
+		}
+		result->runs[result->run_count++] = now_ns() - start;
+	}
+
+	snprintf(result->name, sizeof(result->name), "check_stream");
+	result->iterations = CHECK_STREAM_ITERATIONS;
+
+	if(found != BENCH_REPEAT * (int) CHECK_STREAM_ITERATIONS || strcmp(value, "1048576") != 0)
+	{
+		fprintf(stderr, "%s: check_stream returned %s\n", prg_name, value);
+		return 1;
+	}
+	return 0;
+}
+/**
+ *
+ * \brief bench_receive_response function measures the parsing of a response into files
+ *
+ * The synthetic response has the status, an HTML file of file_size bytes and a small
+ * image record, like a response of the business logic.
+ *
+ * \param result passes the result, the runs of this round are added
+ * \param file_size passes the size of the HTML file
+ *
+ * \return 0 when no error occurs
+ * \return 1 on error
+ *
+ */
+int bench_receive_response(struct bench_result *result, size_t file_size)
+{
+	static const char image[] = "PNG!";
+	struct stat file_status;
+	char header[256];
+	char *payload;
+	unsigned long iterations = RECEIVE_BYTES / file_size;
+	unsigned long i;
+	long long start;
+	int header_length;
+	int response_fd;
+	int repeat;
+	int check = 0;
+
+	iterations = (iterations > 2000) ? 2000 : iterations;
+
+	payload = malloc(file_size);
+	response_fd = open("response", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if(payload == NULL || response_fd == -1)
+	{
+		fprintf(stderr, "%s: cannot create synthetic response - %s\n", prg_name, strerror(errno));
+		free(payload);
+		return 1;
+	}
+	memset(payload, 'x', file_size);
+	header_length = snprintf(header, sizeof(header), "status=0\nfile=bench.html\nlen=%zu\n", file_size);
+	if(sms_write_all(response_fd, header, (size_t) header_length) == -1
+			|| sms_write_all(response_fd, payload, file_size) == -1)
+	{
+		check = -1;
+	}
+	header_length = snprintf(header, sizeof(header), "file=bench.png\nlen=%zu\n%s", strlen(image), image);
+	if(check == -1 || sms_write_all(response_fd, header, (size_t) header_length) == -1)
+	{
+		fprintf(stderr, "%s: cannot write synthetic response - %s\n", prg_name, strerror(errno));
+		free(payload);
+		close(response_fd);
+		return 1;
+	}
+	free(payload);
+	close(response_fd);
+
+	for(repeat = 0; repeat < BENCH_REPEAT && check == 0; repeat++)
+	{
+		start = now_ns();
+		for(i = 0; i < iterations && check == 0; i++)
+		{
+			/* receive_response() closes the descriptor */
+			response_fd = open("response", O_RDONLY);
+			check = (response_fd == -1 || receive_response(response_fd) != EXIT_SUCCESS) ? -1 : 0;
+		}
+		result->runs[result->run_count++] = now_ns() - start;
+	}
+
+	snprintf(result->name, sizeof(result->name), "receive_response_%zu", file_size);
+	result->iterations = iterations;
+
+	/* the records must have been split where the response says */
+	if(check == 0 && (stat("bench.html", &file_status) == -1 || (size_t) file_status.st_size != file_size
+			|| stat("bench.png", &file_status) == -1 || (size_t) file_status.st_size != strlen(image)))
+	{
+		check = -1;
+	}
+	unlink("response");
+	unlink("bench.html");
+	unlink("bench.png");
+
+	if(check == -1)
+	{
+		fprintf(stderr, "%s: receive_response failed for %zu bytes\n", prg_name, file_size);
+		return 1;
+	}
+	return 0;
+}
+/**
+ *
+ * \brief bench_send_message function measures formatting and sending a request
+ *
+ * The client side of a socket pair gets the request, the other side has already sent
+ * an empty response (status only), so send_message() returns without a server.
+ *
+ * \param result passes the result, the runs of this round are added
+ *
+ * \return 0 when no error occurs
+ * \return 1 on error
+ *
+ */
+int bench_send_message(struct bench_result *result)
+{
+	char message[MESSAGE_SIZE + 1];
+	char request[2 * MESSAGE_SIZE];
+	int socket_pair[2];
+	unsigned long i;
+	long long start;
+	ssize_t request_length = 0;
+	int repeat;
+	int check = 0;
+
+	memset(message, 'm', MESSAGE_SIZE);
+	message[MESSAGE_SIZE] = '\0';
+
+	for(repeat = 0; repeat < BENCH_REPEAT && check == 0; repeat++)
+	{
+		start = now_ns();
+		for(i = 0; i < SEND_MESSAGE_ITERATIONS && check == 0; i++)
+		{
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, socket_pair) == -1
+					|| sms_write_all(socket_pair[1], "status=0\n", strlen("status=0\n")) == -1
+					|| shutdown(socket_pair[1], SHUT_WR) == -1)
+			{
+				check = -1;
+				break;
+			}
+			/* closes socket_pair[0] */
+			if(send_message(socket_pair[0], "bench", message, NULL) != EXIT_SUCCESS)
+			{
+				check = -1;
+			}
+			request_length = read(socket_pair[1], request, sizeof(request));
+			close(socket_pair[1]);
+		}
+		result->runs[result->run_count++] = now_ns() - start;
+	}
+	unlink("vcs_tcpip_bulletin_board_response.html");
+
+	snprintf(result->name, sizeof(result->name), "send_message");
+	result->iterations = SEND_MESSAGE_ITERATIONS;
+
+	/* user=bench\n<message>\n */
+	if(check == -1 || request_length != (ssize_t) (strlen("user=bench\n") + MESSAGE_SIZE + 1))
+	{
+		fprintf(stderr, "%s: send_message failed - %s\n", prg_name, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+/**
+ *
+ * \brief bench_accept_to_spawn function measures a request to a server on the loopback interface
+ *
+ * The server is built with a stand-in business logic (make bench uses /bin/cat), so the
+ * time is spent in accept(), the request checks, fork() and execlp() of the server.
+ * With a unix:/path endpoint the same requests go through a unix domain socket instead
+ * of the TCP/IP stack.
+ *
+ * \param result passes the result, the runs of this round are added
+ * \param server passes the server binary
+ * \param port passes the port the server listens on, "0" for a free port, or unix:/path
+ * \param name passes the name of the benchmark
+ *
+ * \return 0 when no error occurs
+ * \return 1 on error
+ *
+ */
+int bench_accept_to_spawn(struct bench_result *result, const char *server, const char *port, const char *name)
+{
+	struct sockaddr_storage address;
+	socklen_t address_length;
+	char chosen_port[PATH_MAX + sizeof(SMS_UNIX_PREFIX)];
+	int unix_socket = (strncmp(port, SMS_UNIX_PREFIX, strlen(SMS_UNIX_PREFIX)) == 0);
+	char message[MESSAGE_SIZE + 1];
+	char request[2 * MESSAGE_SIZE];
+	char response[2 * MESSAGE_SIZE];
+	unsigned long i;
+	long long start;
+	size_t request_length;
+	ssize_t bytes_read;
+	size_t response_length = 0;
+	pid_t server_pid = -1;
+	int socket_desc = -1;
+	int repeat;
+	int attempt;
+	int check = 0;
+
+	/* a chosen port may be taken by another program before the server binds it - choose again */
+	for(attempt = 0; attempt < SERVER_START_ATTEMPTS && server_pid == -1; attempt++)
+	{
+		if(unix_socket)
+		{
+			snprintf(chosen_port, sizeof(chosen_port), "%s", port);
+		}
+		else if(free_port(port, chosen_port, sizeof(chosen_port)) == -1)
+		{
+			fprintf(stderr, "%s: port %s is not free - %s\n", prg_name, port, strerror(errno));
+			return 1;
+		}
+		server_pid = start_server(server, chosen_port, &address, &address_length);
+		if(unix_socket || strcmp(port, "0") != 0)
+		{
+			break;
+		}
+	}
+	if(server_pid == -1)
+	{
+		fprintf(stderr, "%s: server %s does not listen on port %s\n", prg_name, server, chosen_port);
+		return 1;
+	}
+
+	memset(message, 'm', MESSAGE_SIZE);
+	message[MESSAGE_SIZE] = '\0';
+	request_length = (size_t) snprintf(request, sizeof(request), "user=bench\n%s\n", message);
+
+	for(repeat = 0; repeat < BENCH_REPEAT && check == 0; repeat++)
+	{
+		start = now_ns();
+		for(i = 0; i < ACCEPT_ITERATIONS && check == 0; i++)
+		{
+			socket_desc = socket(address.ss_family, SOCK_STREAM, 0);
+			if(socket_desc == -1 || connect(socket_desc, (struct sockaddr *) &address, address_length) == -1
+					|| sms_write_all(socket_desc, request, request_length) == -1 || shutdown(socket_desc, SHUT_WR) == -1)
+			{
+				check = -1;
+			}
+			/* the stand-in echoes the request */
+			for(response_length = 0; check == 0
+					&& (bytes_read = read(socket_desc, response, sizeof(response))) > 0; response_length += (size_t) bytes_read);
+			if(socket_desc != -1)
+			{
+				close(socket_desc);
+			}
+		}
+		result->runs[result->run_count++] = now_ns() - start;
+	}
+
+	kill(server_pid, SIGTERM);
+	waitpid(server_pid, NULL, 0);
+	/* the server leaves its socket file behind */
+	if(unix_socket)
+	{
+		unlink(port + strlen(SMS_UNIX_PREFIX));
+	}
+
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->iterations = ACCEPT_ITERATIONS;
+
+	if(check == -1 || response_length != request_length)
+	{
+		fprintf(stderr, "%s: request to %s failed - %s\n", prg_name, server, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+/**
+ *
+ * \brief free_port function checks that a loopback port is free, or chooses a free one
+ *
+ * The port is bound to a socket, for port 0 the kernel chooses an ephemeral port. The
+ * socket is closed again, so the port is only free until another program binds it -
+ * but a server already listening on it is not mistaken for the stand-in server.
+ *
+ * \param wanted passes the port number, "0" for any free port
+ * \param port returns the port number
+ * \param size passes the size of port
+ *
+ * \return 0 when no error occurs
+ * \return -1 if the port is in use or on error
+ *
+ */
+int free_port(const char *wanted, char *port, size_t size)
+{
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof(address);
+	char *end_ptr;
+	long port_number;
+	int socket_desc;
+	int reuse = 1;
+	int check = -1;
+
+	port_number = strtol(wanted, &end_ptr, 10);
+	if(*wanted == '\0' || *end_ptr != '\0' || port_number < 0 || port_number > 65535)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	socket_desc = socket(AF_INET, SOCK_STREAM, 0);
+	if(socket_desc == -1)
+	{
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((uint16_t) port_number);
+	/* like the server, so connections of an earlier run in TIME_WAIT do not count */
+	if(setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0
+			&& bind(socket_desc, (struct sockaddr *) &address, sizeof(address)) == 0
+			&& getsockname(socket_desc, (struct sockaddr *) &address, &address_length) == 0)
+	{
+		snprintf(port, size, "%u", (unsigned int) ntohs(address.sin_port));
+		check = 0;
+	}
+	close(socket_desc);
+
+	return check;
+}
+/**
+ *
+ * \brief start_server function starts the server and waits until it listens on the loopback interface or unix socket
+ *
+ * The server is probed with connect() for up to SERVER_START_MS. A server which exits
+ * in the meantime, e.g. because the port is in use, is not waited for any longer.
+ *
+ * \param server passes the server binary
+ * \param port passes the port the server listens on, or unix:/path
+ * \param address returns the address of the server
+ * \param address_length returns the length of the address
+ *
+ * \return process ID of the server
+ * \return -1 if it does not listen
+ *
+ */
+pid_t start_server(const char *server, const char *port, struct sockaddr_storage *address, socklen_t *address_length)
+{
+	struct addrinfo hints;
+	struct addrinfo *loopback;
+	char probe_buffer[64];
+	struct timespec delay = { 0, SERVER_POLL_MS * 1000000L };
+	pid_t server_pid;
+	int socket_desc = -1;
+	int waited;
+
+	memset(address, 0, sizeof(*address));
+	if(strncmp(port, SMS_UNIX_PREFIX, strlen(SMS_UNIX_PREFIX)) == 0)
+	{
+		if(sms_unix_address(port, (struct sockaddr_un *) address, address_length) != 1)
+		{
+			fprintf(stderr, "%s: invalid unix socket %s\n", prg_name, port);
+			return -1;
+		}
+	}
+	else
+	{
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if(getaddrinfo("127.0.0.1", port, &hints, &loopback) != 0)
+		{
+			fprintf(stderr, "%s: invalid port %s\n", prg_name, port);
+			return -1;
+		}
+		memcpy(address, loopback->ai_addr, loopback->ai_addrlen);
+		*address_length = loopback->ai_addrlen;
+		freeaddrinfo(loopback);
+	}
+
+	server_pid = fork();
+	if(server_pid == -1)
+	{
+		fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+	if(server_pid == 0)
+	{
+		execl(server, server, "-p", port, (char *) NULL);
+		fprintf(stderr, "%s: cannot start %s - %s\n", prg_name, server, strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	for(waited = 0; waited < SERVER_START_MS; waited += SERVER_POLL_MS)
+	{
+		socket_desc = socket(address->ss_family, SOCK_STREAM, 0);
+		if(socket_desc != -1 && connect(socket_desc, (struct sockaddr *) address, *address_length) == 0)
+		{
+			/* the probe connection is not a request - a unix socket server answers it at
+			 * once, its error status is read so that it does not report a broken pipe */
+			if(address->ss_family == AF_UNIX && shutdown(socket_desc, SHUT_WR) == 0)
+			{
+				while(read(socket_desc, probe_buffer, sizeof(probe_buffer)) > 0);
+			}
+			close(socket_desc);
+			return server_pid;
+		}
+		if(socket_desc != -1)
+		{
+			close(socket_desc);
+		}
+		if(waitpid(server_pid, NULL, WNOHANG) == server_pid)
+		{
+			return -1;
+		}
+		nanosleep(&delay, NULL);
+	}
+
+	kill(server_pid, SIGTERM);
+	waitpid(server_pid, NULL, 0);
+	return -1;
+}
+/**
+ *
+ * \brief write_json function writes the results, one benchmark per line
+ *
+ * \param path passes the output file, NULL for stdout
+ * \param results passes the results
+ * \param count passes the number of results
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int write_json(const char *path, const struct bench_result *results, size_t count)
+{
+	FILE *out = stdout;
+	size_t i;
+	int check;
+
+	if(path != NULL)
+	{
+		out = fopen(path, "w");
+		if(out == NULL)
+		{
+			fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, path, strerror(errno));
+			return -1;
+		}
+	}
+
+	check = fprintf(out, "{\n\t\"benchmarks\": [\n");
+	for(i = 0; i < count && check >= 0; i++)
+	{
+		check = fprintf(out, "\t\t{\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, "
+				"\"median_error_percent\": %.1f}%s\n", results[i].name, results[i].iterations, results[i].ns_per_op,
+				results[i].median_error_percent, (i + 1 < count) ? "," : "");
+	}
+	if(check >= 0)
+	{
+		check = fprintf(out, "\t]\n}\n");
+	}
+
+	if((path != NULL && fclose(out) != 0) || (path == NULL && fflush(out) != 0) || check < 0)
+	{
+		fprintf(stderr, "%s: cannot write results - %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+/**
+ *
+ * \brief compare_baseline function compares the results with the results of an earlier run
+ *
+ * A benchmark regresses if its median is slower than threshold percent plus twice the
+ * standard error of the difference (from median_error_percent of this run and of the
+ * baseline), so a benchmark that varies a lot on this host needs a larger slowdown to
+ * fail the run. Baselines without median_error_percent count as exact. A missing
+ * baseline is not an error, make bench-baseline creates it.
+ *
+ * \param path passes the JSON file of the earlier run
+ * \param results passes the results
+ * \param count passes the number of results
+ * \param threshold passes the slowdown in percent that counts as regression
+ *
+ * \return number of regressed benchmarks
+ * \return -1 on error
+ *
+ */
+int compare_baseline(const char *path, const struct bench_result *results, size_t count, double threshold)
+{
+	struct bench_result baseline;
+	char line[256];
+	FILE *baseline_file;
+	double change;
+	double margin;
+	size_t i;
+	int regressions = 0;
+
+	baseline_file = fopen(path, "r");
+	if(baseline_file == NULL)
+	{
+		if(errno == ENOENT)
+		{
+			fprintf(stderr, "no baseline %s - run make bench-baseline to create it\n", path);
+			return 0;
+		}
+		fprintf(stderr, "%s: cannot open baseline %s - %s\n", prg_name, path, strerror(errno));
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), baseline_file) != NULL)
+	{
+		baseline.median_error_percent = 0;
+		if(sscanf(line, " {\"name\": \"%63[^\"]\", \"iterations\": %lu, \"ns_per_op\": %lf, \"median_error_percent\": %lf",
+				baseline.name, &baseline.iterations, &baseline.ns_per_op, &baseline.median_error_percent) < 3
+				|| baseline.ns_per_op <= 0)
+		{
+			continue;
+		}
+		for(i = 0; i < count && strcmp(results[i].name, baseline.name) != 0; i++);
+		if(i == count)
+		{
+			continue;
+		}
+
+		change = (results[i].ns_per_op / baseline.ns_per_op - 1.0) * 100.0;
+		margin = threshold + 2 * sqrt(results[i].median_error_percent * results[i].median_error_percent
+				+ baseline.median_error_percent * baseline.median_error_percent);
+		fprintf(stderr, "%-28s %+7.1f%% against baseline (allowed %.1f%%)%s\n", baseline.name, change, margin,
+				(change > margin) ? " - REGRESSION" : "");
+		if(change > margin)
+		{
+			regressions++;
+		}
+	}
+	fclose(baseline_file);
+
+	if(regressions > 0)
+	{
+		fprintf(stderr, "%s: %d benchmark(s) slower than %.1f%% plus noise against baseline %s\n", prg_name, regressions,
+				threshold, path);
+	}
+	return regressions;
+}
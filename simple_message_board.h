@@ -0,0 +1,71 @@
+/**
+ * @file simple_message_board.h
+ *
+ * VCS TCP/IP Client and Server - board index kept by the server (--board) and query requests
+ *
+ * Every post the business logic accepts (status=0) is appended to SMS_BOARD_LOG as a struct
+ * sms_board_entry followed by user name, image URL and message, padded to
+ * SMS_BOARD_ALIGN bytes. Entry IDs start at 1; entry N is described by the Nth struct
+ * sms_board_index in SMS_BOARD_INDEX, so a page of entries is found without reading the
+ * entries before it.
+ *
+ * A request starting with "query=since=<id>&limit=<n>" is answered by the server with
+ * the entries after <id>. With "&format=binary" the answer is a snapshot: SMS_BOARD_MAGIC
+ * followed by the entries exactly as they are stored in the log, so snapshots of
+ * consecutive pages can be appended to each other (client --merge).
+ *
+ * @author: Claudia Baierl - ic14b003 <ic14b003@technikum-wien.at>
+ * @author: Zuebide Sayici - ic14b002 <ic14b002@technikum-wien.at>
+ *
+ * @version $Revision: 1 $
+ *
+ * Last Modified: $Author: Claudia Baierl $
+ */
+
+#ifndef SIMPLE_MESSAGE_BOARD_H
+#define SIMPLE_MESSAGE_BOARD_H
+
+/*
+ * ----------------------------- includes -------------------------
+ */
+
+#include <stdint.h>
+
+/*
+ * ---------------------------------- defines ------------------------
+ */
+
+#define SMS_BOARD_LOG "board.log"
+#define SMS_BOARD_INDEX "board.idx"
+#define SMS_BOARD_QUERY_PREFIX "query="
+#define SMS_BOARD_MAGIC "SMSBRD01"
+#define SMS_BOARD_MAGIC_LENGTH 8
+#define SMS_BOARD_ALIGN 8
+/* length of an entry including padding */
+#define SMS_BOARD_PADDED(length) (((length) + SMS_BOARD_ALIGN - 1) & ~((uint64_t) SMS_BOARD_ALIGN - 1))
+/* response files of query requests */
+#define SMS_BOARD_PAGE_FILE "board_page.txt"
+#define SMS_BOARD_SNAPSHOT_FILE "board_snapshot.bin"
+
+/*
+ * ---------------------------------- typedefs -----------------------
+ */
+
+struct sms_board_entry
+{
+	uint64_t id;
+	/* time the post was accepted (CLOCK_REALTIME, nanoseconds) */
+	uint64_t posted_ns;
+	uint32_t user_length;
+	uint32_t image_length;
+	uint64_t message_length;
+};
+
+struct sms_board_index
+{
+	/* position of the entry in the log and its length including padding */
+	uint64_t offset;
+	uint64_t length;
+};
+
+#endif /* SIMPLE_MESSAGE_BOARD_H */
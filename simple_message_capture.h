@@ -0,0 +1,52 @@
+/**
+ * @file simple_message_capture.h
+ *
+ * VCS TCP/IP Client and Server - format of request captures (server --capture, client --replay)
+ *
+ * A capture file starts with SMS_CAPTURE_MAGIC, followed by one record per connection:
+ * a struct sms_capture_record and the request bytes, padded to SMS_CAPTURE_ALIGN bytes so
+ * that every record header is aligned when the file is mapped with mmap(). Requests longer
+ * than the capture limit of the server are truncated, the record keeps their original length.
+ *
+ * @author: Claudia Baierl - ic14b003 <ic14b003@technikum-wien.at>
+ * @author: Zuebide Sayici - ic14b002 <ic14b002@technikum-wien.at>
+ *
+ * @version $Revision: 1 $
+ *
+ * Last Modified: $Author: Claudia Baierl $
+ */
+
+#ifndef SIMPLE_MESSAGE_CAPTURE_H
+#define SIMPLE_MESSAGE_CAPTURE_H
+
+/*
+ * ----------------------------- includes -------------------------
+ */
+
+#include <stdint.h>
+
+/*
+ * ---------------------------------- defines ------------------------
+ */
+
+#define SMS_CAPTURE_MAGIC "SMSCAP02"
+#define SMS_CAPTURE_MAGIC_LENGTH 8
+#define SMS_CAPTURE_ALIGN 8
+/* length of a record including padding */
+#define SMS_CAPTURE_PADDED(length) (((length) + SMS_CAPTURE_ALIGN - 1) & ~((uint64_t) SMS_CAPTURE_ALIGN - 1))
+
+/*
+ * ---------------------------------- typedefs -----------------------
+ */
+
+struct sms_capture_record
+{
+	/* time the connection was accepted (CLOCK_REALTIME, nanoseconds) */
+	uint64_t arrival_ns;
+	/* number of request bytes following the record header */
+	uint64_t length;
+	/* length of the request, larger than length if the request was truncated */
+	uint64_t original_length;
+};
+
+#endif /* SIMPLE_MESSAGE_CAPTURE_H */
@@ -15,6 +15,8 @@
  * ----------------------------- includes -------------------------
  */
 
+/* splice() */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <error.h>
@@ -27,7 +29,22 @@
 #include <arpa/inet.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <sys/file.h>
+#include <poll.h>
 #include <simple_message_client_commandline_handling.h>
+#include "simple_message_socket.h"
+#include "simple_message_capture.h"
+#include "simple_message_board.h"
 
 /*
  * ---------------------------------- defines ------------------------
@@ -35,6 +52,92 @@
 
 #define QUEUESIZE 10 /*number of pending connections for connection queue */
 #define MAXIMUM_SIZE 2048
+/* message argument which makes the client stream the message from stdin or a file */
+#define STREAM_MESSAGE "-"
+/* chunk size used when streaming a message from a pipe */
+#define STREAM_CHUNK_SIZE 65536
+/* environment variable with the endpoint of a running client agent (unix:/path) */
+#define AGENT_ENVIRONMENT "SMC_AGENT"
+/* number of server endpoints the agent keeps connections for */
+#define AGENT_POOLS 16
+/* pre-connected sockets kept per server endpoint */
+#define AGENT_WARM 2
+/* seconds a getaddrinfo() result is reused by the agent */
+#define AGENT_DNS_SECONDS 60
+/* agent: timeout of its connects to servers and of reading/writing a client run */
+#define AGENT_CONNECT_TIMEOUT_MS 2000
+#define AGENT_IO_TIMEOUT_MS 1000
+/* client run: how long to wait for the socket from the agent before connecting directly */
+#define AGENT_REPLY_TIMEOUT_MS 3000
+/* first and longest pause of the agent after accept() failed (e.g. EMFILE) */
+#define AGENT_ACCEPT_BACKOFF_MS 10
+#define AGENT_ACCEPT_BACKOFF_MAX_MS 1000
+/* go-ahead of the server for the bytes of an image upload (--image-file), and how long to wait for it */
+#define CONTINUE_LINE "continue\n"
+#define CONTINUE_TIMEOUT_MS 5000
+/* request line asking the server for compressed file= records (--compress) */
+#define ACCEPT_ENCODING "accept-encoding=deflate"
+#define ENCODING_DEFLATE "deflate"
+/* nanoseconds per microsecond, latencies are reported in microseconds */
+#define NS_PER_US 1000LL
+#define NS_PER_S 1000000000LL
+/* mkstemp() template appended to response files written in --dedupe mode */
+#define TEMP_SUFFIX ".XXXXXX"
+/* connect retries (--retries): first backoff, maximum backoff and default budget in ms */
+#define RETRY_BASE_MS 100
+#define RETRY_CAP_MS 2000
+#define RETRY_BUDGET_MS 10000
+/* circuit breaker: failed connects in a row that open it and seconds it stays open */
+#define BREAKER_FAILURES 5
+#define BREAKER_OPEN_SECONDS 30
+
+/*
+ * ---------------------------------- typedefs -----------------------
+ */
+
+/* file a file= record of the response is written to */
+struct response_file
+{
+	char name[MAXIMUM_SIZE];
+	char temp_name[MAXIMUM_SIZE + sizeof(TEMP_SUFFIX)];
+	/* file the payload is written to - in --dedupe mode NULL as long as it equals the existing file */
+	FILE *write_to;
+	/* existing file with the same name (--dedupe mode only) */
+	FILE *existing;
+	/* number of bytes equal to the existing file */
+	long matched;
+	int open;
+};
+
+/* server endpoint the client agent keeps resolved addresses and connections for */
+struct agent_pool
+{
+	char server[NI_MAXHOST];
+	char port[NI_MAXSERV];
+	/* cached getaddrinfo() result, NULL for unix:/path servers */
+	struct addrinfo *addresses;
+	time_t resolved;
+	int warm[AGENT_WARM];
+	int warm_count;
+};
+
+/* latency summary of a replay run */
+struct replay_statistics
+{
+	size_t count;
+	size_t failed;
+	long long mean_us;
+	long long p50_us;
+	long long p99_us;
+	long long max_us;
+};
+
+/* circuit breaker of a server endpoint, shared by all client runs through a state file */
+struct breaker_state
+{
+	long failures;
+	long long open_until;
+};
 
 /*
  * ---------------------------------- globals ------------------------
@@ -43,6 +146,40 @@
 const char *prg_name;
 static int verbose = 0;
 int status;
+/* file the message is streamed from (--message-file), NULL for stdin */
+static const char *message_file = NULL;
+/* local image uploaded with the message (--image-file) */
+static const char *image_file = NULL;
+/* do not rewrite response files whose content did not change (--dedupe) */
+static int dedupe = 0;
+/* endpoint to run the client agent on (--agent) */
+static const char *agent_endpoint = NULL;
+/* timeout of connect() in ms, 0 blocks (the agent must not hang on an unreachable server) */
+static long connect_timeout_ms = 0;
+/* descriptor response records are streamed to instead of files (--stdout, --output-fd), -1 for files */
+static int output_fd = -1;
+/* capture file of the server to replay (--replay) and replay options */
+static const char *replay_path = NULL;
+static double replay_speed = 1.0;
+static const char *latency_path = NULL;
+static const char *baseline_path = NULL;
+/* ask the server for compressed file= records (--compress) */
+static int compress_response = 0;
+/* query of the board index (--query, --limit, --snapshot), NULL for a post */
+static const char *query_since = NULL;
+static const char *query_limit = NULL;
+static int query_snapshot = 0;
+/* local snapshot the received entries are merged into (--merge) */
+static const char *merge_path = NULL;
+/* connect retries (--retries, --retry-budget) and what they cost, for the exit summary */
+static int retries = 0;
+static long retry_budget_ms = RETRY_BUDGET_MS;
+static int retries_done = 0;
+static long long backoff_ms = 0;
+/* failed connects of single attempts are not reported while connect_retry() still tries,
+ * connect_error keeps the errno of the last one */
+static int quiet_connect = 0;
+static int connect_error = 0;
 
 /*
  * ---------------------------------- function prototypes ------------
@@ -52,11 +189,50 @@ int status;
 static void usage(FILE *out, const char *prog_name, int exit_status);
 int send_message(int socket_desc, const char *user, const char *message, const char *image);
 int receive_response(int socket_desc);
+int connect_server(const char *server, const char *port);
+int connect_addresses(struct addrinfo *set_info);
+int connect_with_timeout(int socket_desc, const struct sockaddr *address, socklen_t address_length);
+int set_socket_timeout(int socket_desc, long timeout_ms);
+int connect_retry(const char *server, const char *port);
+int retryable_error(int error);
+static int breaker_state_path(const char *server, const char *port, char *path, size_t size);
+int breaker_open(const char *server, const char *port, struct breaker_state *state);
+void breaker_update(const char *server, const char *port, int connected);
+void retry_summary(void);
+int connect_agent(const char *agent, const char *server, const char *port);
+int run_agent(const char *endpoint);
+struct agent_pool *agent_find_pool(const char *server, const char *port);
+int agent_connect(struct agent_pool *pool);
+int agent_take_connection(struct agent_pool *pool);
+int stream_record(int socket_desc, const char *name, int length);
+int run_replay(int argc, const char **argv);
+long long replay_request(const char *server, const char *port, const char *request, size_t length);
+int run_query(int argc, const char **argv);
+int snapshot_last_id(int fd, uint64_t *last_id, off_t *end);
+int merge_snapshot(const char *snapshot_path, const char *merge_path);
+void replay_statistics(const long long *latencies, size_t count, struct replay_statistics *statistics);
+int compare_latency(const void *left, const void *right);
+int compare_arrival(const void *left, const void *right);
+int read_latency_file(const char *path, long long **latencies, size_t *count);
+int inflate_record(FILE *client_socket, struct response_file *response, int length);
 void verbose_print(const char *format, ...);
+FILE *report_stream(void);
 int check_stream(char *stream, const char *lookup, char *value);
 void my_close(FILE *fp);
-
-
+int parse_extra_options(int argc, const char * const argv[], const char **smc_argv);
+int match_option(const char *name, int argc, const char * const argv[], int *index, const char **value);
+int stream_message(int socket_desc, const char *path);
+int stream_image(FILE *message_desc, int socket_desc, const char *path);
+int wait_for_continue(int socket_desc);
+int response_open(struct response_file *response, const char *name);
+int response_create_temp(struct response_file *response);
+int response_write(struct response_file *response, const char *buffer, int length);
+int response_close(struct response_file *response);
+void response_abort(struct response_file *response);
+
+
+/* make bench links the client functions into the benchmark, which has its own main() */
+#ifndef SMC_BENCH
 /**
  *
  * \brief Main function is the entry point for any C programme
@@ -71,11 +247,11 @@ void my_close(FILE *fp);
 int main(int argc, const char * const argv[])
 {
 
-	struct addrinfo client_info, *set_info, *rp;
-
-	int check;
 	int socket_desc;
-	int connect_socket;
+	int smc_argc;
+	const char **smc_argv;
+	const char *agent;
+	int check;
 
 	const char *server = NULL;
 	const char *port = NULL;
@@ -84,9 +260,130 @@ int main(int argc, const char * const argv[])
 	const char *image = NULL;
 	
 
-	smc_parsecommandline(argc, argv, &usage, &server, &port, &user, &message, &image, &verbose);
 	prg_name = argv[0];
 
+	/* options not known to smc_parsecommandline() are taken out of argv first */
+	smc_argv = malloc((argc + 3) * sizeof(*smc_argv));
+	if(smc_argv == NULL)
+	{
+		fprintf(stderr, "%s: malloc failed - %s\n", prg_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	smc_argc = parse_extra_options(argc, argv, smc_argv);
+
+	/* long running agent, serves pre-connected sockets to other client runs */
+	if(agent_endpoint != NULL)
+	{
+		free(smc_argv);
+		return run_agent(agent_endpoint);
+	}
+
+	/* replay of a server capture, needs only -s and -p */
+	if(replay_path != NULL)
+	{
+		check = run_replay(smc_argc, smc_argv);
+		free(smc_argv);
+		return check;
+	}
+
+	/* query of the board index instead of a post, needs only -s and -p */
+	if((query_limit != NULL || query_snapshot) && query_since == NULL && merge_path == NULL)
+	{
+		fprintf(stderr, "%s: --limit and --snapshot are only used with --query or --merge\n", prg_name);
+		free(smc_argv);
+		usage(stderr, argv[0], EXIT_FAILURE);
+	}
+	if(query_since != NULL || merge_path != NULL)
+	{
+		check = run_query(smc_argc, smc_argv);
+		free(smc_argv);
+		return check;
+	}
+
+	smc_parsecommandline(smc_argc, smc_argv, &usage, &server, &port, &user, &message, &image, &verbose);
+	free(smc_argv);
+
+	/* take a pre-connected socket from a running agent, connect directly if there is none */
+	socket_desc = -1;
+	agent = getenv(AGENT_ENVIRONMENT);
+	if(agent != NULL)
+	{
+		socket_desc = connect_agent(agent, server, port);
+	}
+	if(socket_desc == -1)
+	{
+		socket_desc = (retries > 0) ? connect_retry(server, port) : connect_server(server, port);
+	}
+	if(socket_desc == -1)
+	{
+		return EXIT_FAILURE;
+	}
+
+	if(send_message(socket_desc, user, message, image) != 0)
+	{
+		fprintf(stderr, "%s: Failure in sending message.", prg_name);
+		close(socket_desc);
+		return EXIT_FAILURE;
+	}
+
+	/*close the socket connection*/
+	close(socket_desc);
+	return 0;
+
+}
+#endif
+
+
+/**
+ *
+ * \brief connect_server function connects to the server
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path for a local server
+ * \param port passes the port of the server (not used for unix:/path)
+ *
+ * \return connected socket descriptor
+ * \return -1 on error
+ *
+ */
+int connect_server(const char *server, const char *port)
+{
+	struct addrinfo client_info, *set_info;
+	struct sockaddr_un unix_address;
+	socklen_t unix_address_length;
+
+	int check;
+	int socket_desc = -1;
+
+	/* unix:/path talks to a server on the same host without the TCP/IP stack */
+	check = sms_unix_address(server, &unix_address, &unix_address_length);
+	if(check == -1)
+	{
+		fprintf(stderr, "%s: invalid unix socket path %s\n", prg_name, server);
+		return -1;
+	}
+	if(check == 1)
+	{
+		socket_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(socket_desc == -1)
+		{
+			fprintf(stderr, "%s: Cannot create socket - %s\n", prg_name, strerror(errno));
+			return -1;
+		}
+		if(connect_with_timeout(socket_desc, (struct sockaddr *) &unix_address, unix_address_length) == -1)
+		{
+			connect_error = errno;
+			if(!quiet_connect)
+			{
+				fprintf(stderr, "%s: Cannot connect() to socket - %s\n", prg_name, strerror(errno));
+			}
+			close(socket_desc);
+			errno = connect_error;
+			return -1;
+		}
+		verbose_print(", %s(), line %d] Connected to %s\n",  __func__, __LINE__, server);
+		return socket_desc;
+	}
+
 	//client_info is set to 0
 	memset(&client_info, 0, sizeof(client_info));
 	/*not specified if IPv4 or IPv6 - both can be used*/
@@ -101,9 +398,33 @@ int main(int argc, const char * const argv[])
 	if(check != 0)
 	{
 		fprintf(stderr, "%s: getaddrinfo failed: %s\n", prg_name, gai_strerror(check));
-		return EXIT_FAILURE;
+		return -1;
 	}
 
+	socket_desc = connect_addresses(set_info);
+
+	/* is no longer needed */
+	freeaddrinfo(set_info);
+
+	return socket_desc;
+}
+
+/**
+ *
+ * \brief connect_addresses function connects to the first reachable address of a getaddrinfo() result
+ *
+ * \param set_info passes the addresses of the server
+ *
+ * \return connected socket descriptor
+ * \return -1 on error
+ *
+ */
+int connect_addresses(struct addrinfo *set_info)
+{
+	struct addrinfo *rp;
+	int socket_desc = -1;
+	int connect_socket;
+
 	/* go through all he results and connect if possible - if not, try the next one */
 	for (rp = set_info; rp != NULL; rp = rp->ai_next)
 	{
@@ -115,10 +436,11 @@ int main(int argc, const char * const argv[])
 		}
 
 		/* connect to the socket  with connect*/
-		connect_socket = connect(socket_desc, rp->ai_addr, rp->ai_addrlen);
+		connect_socket = connect_with_timeout(socket_desc, rp->ai_addr, rp->ai_addrlen);
 		verbose_print(", %s(), line %d] Connect to socket: %d\n",  __func__, __LINE__, connect_socket);
 		if(connect_socket == -1)
 		{
+			close(socket_desc);
 			continue;
 		}
 
@@ -129,324 +451,2429 @@ int main(int argc, const char * const argv[])
 
 	if(rp == NULL)
 	{
-		fprintf(stderr, "%s: Cannot connect() to socket - %s\n", prg_name, strerror(errno));
-		freeaddrinfo(set_info);
-		return EXIT_FAILURE;
+		connect_error = errno;
+		if(!quiet_connect)
+		{
+			fprintf(stderr, "%s: Cannot connect() to socket - %s\n", prg_name, strerror(errno));
+		}
+		return -1;
 	}
 
-	/* is no longer needed */
-	freeaddrinfo(set_info);
+	return socket_desc;
+}
+/**
+ *
+ * \brief connect_with_timeout function connects a socket, giving up after connect_timeout_ms
+ *
+ * Without a timeout this is a plain (blocking) connect(). Otherwise the socket is
+ * connected non-blocking and poll() waits for the result; the socket is blocking again
+ * afterwards, client runs expect that.
+ *
+ * \param socket_desc passes the socket descriptor
+ * \param address passes the address of the server
+ * \param address_length passes the length of the address
+ *
+ * \return 0 when connected
+ * \return -1 on error (errno is set, ETIMEDOUT after the timeout)
+ *
+ */
+int connect_with_timeout(int socket_desc, const struct sockaddr *address, socklen_t address_length)
+{
+	struct pollfd poll_desc;
+	socklen_t error_length = sizeof(int);
+	int flags;
+	int error;
+	int check;
 
-	if(send_message(socket_desc, user, message, image) != 0)
+	if(connect_timeout_ms <= 0)
 	{
-		fprintf(stderr, "%s: Failure in sending message.", prg_name);
-		close(socket_desc);
-		return EXIT_FAILURE;
+		return connect(socket_desc, address, address_length);
 	}
 
-	/*close the socket connection*/
-	close(socket_desc);
-	return 0;
+	flags = fcntl(socket_desc, F_GETFL);
+	if(flags == -1 || fcntl(socket_desc, F_SETFL, flags | O_NONBLOCK) == -1)
+	{
+		return -1;
+	}
 
-}
+	check = connect(socket_desc, address, address_length);
+	if(check == -1 && errno == EINPROGRESS)
+	{
+		poll_desc.fd = socket_desc;
+		poll_desc.events = POLLOUT;
+		do
+		{
+			check = poll(&poll_desc, 1, (int) connect_timeout_ms);
+		} while(check == -1 && errno == EINTR);
+
+		if(check == 0)
+		{
+			errno = ETIMEDOUT;
+			check = -1;
+		}
+		else if(check > 0)
+		{
+			check = getsockopt(socket_desc, SOL_SOCKET, SO_ERROR, &error, &error_length);
+			if(check == 0 && error != 0)
+			{
+				errno = error;
+				check = -1;
+			}
+		}
+	}
 
+	error = errno;
+	if(fcntl(socket_desc, F_SETFL, flags) == -1)
+	{
+		return -1;
+	}
+	errno = error;
 
+	return check;
+}
 /**
  *
- * \brief send_message function sends user, message and if chosen by user an image
+ * \brief set_socket_timeout function limits how long reads and writes on a socket block
  *
- * \param socket_desc passes the socket_descriptor
- * \param user passes the user who sends the message
- * \param message passes the message to written to the bulletin board
- * \param image passes the image URL to be shown in the bulletin board
+ * \param socket_desc passes the socket descriptor
+ * \param timeout_ms passes the timeout in ms (SO_RCVTIMEO and SO_SNDTIMEO)
  *
- * \return EXIT_SUCCESS when no error occurs
- * \return EXIT_FAILURE on error
+ * \return 0 when no error occurs
+ * \return -1 on error
  *
  */
-int send_message(int socket_desc, const char *user, const char *message, const char *image)
+int set_socket_timeout(int socket_desc, long timeout_ms)
 {
+	struct timeval timeout;
 
-	int send_message;
-	int flush_check;
-	FILE *message_desc = NULL;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
 
+	if(setsockopt(socket_desc, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1
+			|| setsockopt(socket_desc, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+	{
+		return -1;
+	}
 
-		/*open file and associate it to the stream socket -writing mode - stream is positioned at beginning of the file*/
-		message_desc = fdopen(socket_desc, "w");
-		if(message_desc == NULL)
+	return 0;
+}
+/**
+ *
+ * \brief connect_retry function connects to the server, retrying while it is restarting or overloaded
+ *
+ * Failed connects are retried up to --retries times. The backoff doubles from
+ * RETRY_BASE_MS up to RETRY_CAP_MS and a random part of it is slept (full jitter), so
+ * clients failing at the same time do not come back at the same time. No more than
+ * --retry-budget ms are spent in backoff.
+ *
+ * Connect results of all client runs are counted in a per-endpoint circuit breaker:
+ * after BREAKER_FAILURES failed connects in a row the server is not contacted for
+ * BREAKER_OPEN_SECONDS, then a single connect decides whether it stays open.
+ *
+ * A failed connect is reported once, after the last attempt.
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ *
+ * \return connected socket descriptor
+ * \return -1 on error
+ *
+ */
+int connect_retry(const char *server, const char *port)
+{
+	struct breaker_state state;
+	struct timespec delay;
+	long long window_ms;
+	long long sleep_ms;
+	int socket_desc;
+	int error;
+	int attempt;
+
+	if(atexit(retry_summary) != 0)
+	{
+		fprintf(stderr, "%s: atexit failed\n", prg_name);
+	}
+	srandom((unsigned int) (getpid() ^ time(NULL)));
+
+	quiet_connect = 1;
+	for(attempt = 0; ; attempt++)
+	{
+		if(breaker_open(server, port, &state) == 1)
 		{
-			fprintf(stderr, "%s: failed open file for message %s\n", prg_name, strerror(errno));
-			my_close(message_desc);
-			return EXIT_FAILURE;
+			fprintf(stderr, "%s: circuit open for %s:%s after %ld failed connects, not connecting for %llds\n",
+					prg_name, server, port, state.failures, state.open_until - (long long) time(NULL));
+			socket_desc = -1;
+			break;
 		}
 
-		verbose_print(", %s(), line %d] Sent request user =\"%s\"\n",  __func__, __LINE__, user);
+		errno = 0;
+		connect_error = 0;
+		socket_desc = connect_server(server, port);
+		error = errno;
+		breaker_update(server, port, socket_desc != -1);
+		if(socket_desc != -1 || !retryable_error(error) || attempt >= retries)
+		{
+			break;
+		}
 
-		/*user field is required - don't have to check again if username was entered*/
-		/*check message data and send*/
-		/*only send image tag if image was given*/
-		if(image == NULL)
+		/* full jitter: sleep a random time up to the exponential backoff */
+		window_ms = (attempt < 16) ? (long long) RETRY_BASE_MS << attempt : RETRY_CAP_MS;
+		if(window_ms > RETRY_CAP_MS)
 		{
-			verbose_print(", %s(), line %d] message =\"%s\n",  __func__, __LINE__, message);
-			/* send the message to the stream */
-			send_message = fprintf(message_desc,"user=%s\n%s\n", user, message);
-				if (send_message == -1)
-				{
-					fprintf(stderr, "%s: failed to send message - %s\n", prg_name, strerror(errno));
-					my_close(message_desc);
-					return EXIT_FAILURE;
-				}
+			window_ms = RETRY_CAP_MS;
 		}
-		/*message is required - send image and message if image is given*/
-		else
+		sleep_ms = random() % (window_ms + 1);
+		if(backoff_ms + sleep_ms > retry_budget_ms)
 		{
-			verbose_print(", %s(), line %d] img=\"%s\n",  __func__,__LINE__, image);
-			verbose_print(", %s(), line %d] message =\"%s\n", __func__, __LINE__,message);
-			/* send the message to the stream */
-			send_message = fprintf(message_desc,"user=%s\nimg=%s\n%s\n",user, image, message);
-				if (send_message == -1)
-				{
-					fprintf(stderr, "%s: failed to send message - %s\n", prg_name, strerror(errno));
-					my_close(message_desc);
-					return EXIT_FAILURE;
-				}
+			verbose_print(", %s(), line %d] Retry budget of %ld ms used up\n",  __func__, __LINE__, retry_budget_ms);
+			break;
 		}
 
-		/*write all unwritten data to the file/socket */
-		flush_check = fflush(message_desc);
-		if (flush_check != 0)
+		verbose_print(", %s(), line %d] Retry %d in %lld ms\n",  __func__, __LINE__, attempt + 1, sleep_ms);
+		delay.tv_sec = sleep_ms / 1000;
+		delay.tv_nsec = (sleep_ms % 1000) * 1000000L;
+		while(nanosleep(&delay, &delay) == -1 && errno == EINTR)
 		{
-			fprintf(stderr, "%s: failed to flush socket - %s\n", prg_name, strerror(errno));
-			my_close(message_desc);
-			return EXIT_FAILURE;
+			/* sleep the rest */
 		}
+		backoff_ms += sleep_ms;
+		retries_done++;
+	}
 
-		/*block further sending, receiving is still possible with SHUT_WR */
-		if(shutdown(socket_desc, SHUT_WR) != 0)
+	quiet_connect = 0;
+	if(socket_desc == -1 && connect_error != 0)
+	{
+		fprintf(stderr, "%s: Cannot connect() to socket - %s\n", prg_name, strerror(connect_error));
+	}
+	return socket_desc;
+}
+/**
+ *
+ * \brief retryable_error function checks if a failed connect may succeed later
+ *
+ * \param error passes the errno of the failed connect
+ *
+ * \return 1 if the connect should be retried
+ * \return 0 if not
+ *
+ */
+int retryable_error(int error)
+{
+	switch(error)
+	{
+	case ECONNREFUSED:
+	case ECONNRESET:
+	case ETIMEDOUT:
+	case EAGAIN:
+	case EHOSTUNREACH:
+	case ENETUNREACH:
+	/* unix socket of a restarting server */
+	case ENOENT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+/**
+ *
+ * \brief breaker_state_path function returns the name of the breaker state file of an endpoint
+ *
+ * The state files are named smc-breaker-<hash of server:port>. They are kept in
+ * $XDG_RUNTIME_DIR, or else in $TMPDIR/smc-<uid> (default /tmp/smc-<uid>), which is
+ * created for the user and must not be accessible by others - in a shared directory
+ * other users could plant the state file or a symbolic link in its place.
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ * \param path returns the name of the state file
+ * \param size passes the size of path
+ *
+ * \return 0 when no error occurs
+ * \return -1 if there is no private directory (the breaker is not used)
+ *
+ */
+static int breaker_state_path(const char *server, const char *port, char *path, size_t size)
+{
+	char directory[PATH_MAX];
+	struct stat directory_status;
+	const char *base;
+	uint64_t hash;
+	int length;
+
+	hash = sms_fnv1a(SMS_FNV1A_OFFSET_BASIS, server, strlen(server));
+	hash = sms_fnv1a(hash, ":", 1);
+	hash = sms_fnv1a(hash, (port != NULL) ? port : "", (port != NULL) ? strlen(port) : 0);
+
+	base = getenv("XDG_RUNTIME_DIR");
+	if(base != NULL && *base != '\0')
+	{
+		length = snprintf(directory, sizeof(directory), "%s", base);
+	}
+	else
+	{
+		base = getenv("TMPDIR");
+		if(base == NULL || *base == '\0')
 		{
-			fprintf(stderr, "%s: failed to close writing direction - %s\n", prg_name, strerror(errno));
-			my_close(message_desc);
-			return EXIT_FAILURE;
+			base = "/tmp";
 		}
-		verbose_print(", %s(), line %d] Shutdown \n",  __func__, __LINE__);
-
-		if(receive_response(socket_desc) == -1)
+		length = snprintf(directory, sizeof(directory), "%s/smc-%lu", base, (unsigned long) geteuid());
+		if(length > 0 && (size_t) length < sizeof(directory) && mkdir(directory, S_IRWXU) == -1 && errno != EEXIST)
 		{
-			fprintf(stderr, "%s failed to read response - %s", prg_name, strerror(errno));
-			my_close(message_desc);
-			close(socket_desc);
-			return EXIT_FAILURE;
+			verbose_print(", %s(), line %d] Cannot create %s - %s\n",  __func__, __LINE__, directory, strerror(errno));
+			return -1;
 		}
+	}
+	if(length < 0 || (size_t) length >= sizeof(directory))
+	{
+		return -1;
+	}
 
-	my_close(message_desc);
-
-	return EXIT_SUCCESS;
+	/* a directory of the user which nobody else can write to */
+	if(lstat(directory, &directory_status) == -1 || !S_ISDIR(directory_status.st_mode)
+			|| directory_status.st_uid != geteuid() || (directory_status.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+	{
+		verbose_print(", %s(), line %d] %s is no private directory, circuit breaker not used\n",  __func__, __LINE__,
+				directory);
+		return -1;
+	}
 
+	length = snprintf(path, size, "%s/smc-breaker-%016llx", directory, (unsigned long long) hash);
+	return (length < 0 || (size_t) length >= size) ? -1 : 0;
 }
 /**
  *
- * \brief receive_response function receives the servers response
+ * \brief breaker_open function checks if the circuit breaker of an endpoint is open
  *
- * \param socket_desc passes the socket descriptor
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ * \param state returns the state of the breaker
  *
- * \return EXIT_SUCCESS when no error occurs
- * \return EXIT_FAILURE on error
+ * \return 1 if the server must not be contacted
+ * \return 0 if it may be contacted (also if there is no state)
  *
  */
-int receive_response(int socket_desc)
+int breaker_open(const char *server, const char *port, struct breaker_state *state)
 {
-	FILE *client_socket;
-	FILE *write_to = NULL;
-
-	int mode;
-	
-	char receive_buffer[MAXIMUM_SIZE];
-	char value[MAXIMUM_SIZE];
-	int file_length_received = 0;
-	int maximum_buffer = 0;
-	int count = 0;
-	int bytes_received = 0;
-	int bytes_read = 0;
-	int check_write;
+	char path[PATH_MAX];
+	FILE *state_file;
+	int fd;
 
+	state->failures = 0;
+	state->open_until = 0;
 
-	/*open the file for reading*/
-	client_socket = fdopen(socket_desc, "r");
-	if(client_socket == NULL)
+	if(breaker_state_path(server, port, path, sizeof(path)) == -1)
 	{
-		fprintf(stderr, "%s: failed to open socket for reading - %s\n", prg_name,  strerror(errno));
-		/* no leaks if socket is not closed, but we do it to be on the safe side */
-		my_close(client_socket);
+		return 0;
+	}
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if(fd == -1)
+	{
+		return 0;
+	}
+	state_file = fdopen(fd, "r");
+	if(state_file == NULL)
+	{
+		close(fd);
+		return 0;
+	}
+	if(flock(fileno(state_file), LOCK_SH) == -1
+			|| fscanf(state_file, "failures=%ld\nopen_until=%lld\n", &state->failures, &state->open_until) != 2)
+	{
+		state->failures = 0;
+		state->open_until = 0;
+	}
+	fclose(state_file);
+
+	return state->open_until > (long long) time(NULL);
+}
+/**
+ *
+ * \brief breaker_update function records the result of a connect in the circuit breaker of an endpoint
+ *
+ * A successful connect closes the breaker. A failed one opens it for
+ * BREAKER_OPEN_SECONDS once BREAKER_FAILURES connects in a row have failed.
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ * \param connected passes 1 if the connect succeeded, 0 if not
+ *
+ */
+void breaker_update(const char *server, const char *port, int connected)
+{
+	char path[PATH_MAX];
+	FILE *state_file;
+	long failures = 0;
+	long long open_until = 0;
+	int fd;
+
+	if(breaker_state_path(server, port, path, sizeof(path)) == -1)
+	{
+		return;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if(fd == -1)
+	{
+		verbose_print(", %s(), line %d] Cannot open %s - %s\n",  __func__, __LINE__, path, strerror(errno));
+		return;
+	}
+	state_file = fdopen(fd, "r+");
+	if(state_file == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	/* read, modify and write the state under the lock - other clients update it concurrently */
+	if(flock(fd, LOCK_EX) == -1)
+	{
+		fclose(state_file);
+		return;
+	}
+	if(fscanf(state_file, "failures=%ld\nopen_until=%lld\n", &failures, &open_until) != 2)
+	{
+		failures = 0;
+	}
+
+	if(connected)
+	{
+		failures = 0;
+	}
+	else
+	{
+		failures++;
+	}
+	open_until = (failures >= BREAKER_FAILURES) ? (long long) time(NULL) + BREAKER_OPEN_SECONDS : 0;
+
+	rewind(state_file);
+	if(ftruncate(fd, 0) == -1 || fprintf(state_file, "failures=%ld\nopen_until=%lld\n", failures, open_until) < 0)
+	{
+		verbose_print(", %s(), line %d] Cannot write %s - %s\n",  __func__, __LINE__, path, strerror(errno));
+	}
+	/* closing releases the lock */
+	fclose(state_file);
+}
+/**
+ *
+ * \brief retry_summary function reports the connect retries on exit
+ *
+ */
+void retry_summary(void)
+{
+	fprintf(stderr, "%s: connect retries %d, backoff %lld ms\n", prg_name, retries_done, backoff_ms);
+}
+/**
+ *
+ * \brief connect_agent function gets a connected socket to the server from a running client agent
+ *
+ * \param agent passes the endpoint of the agent (unix:/path)
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ *
+ * The agent has to run as the same user, otherwise a socket of a foreign process could
+ * be taken for the server.
+ *
+ * \return connected socket descriptor
+ * \return -1 if there is no agent or it could not connect (the caller connects directly)
+ *
+ */
+int connect_agent(const char *agent, const char *server, const char *port)
+{
+	struct sockaddr_un agent_address;
+	socklen_t agent_address_length;
+	char request[NI_MAXHOST + NI_MAXSERV + 2];
+	int request_length;
+	int agent_desc;
+	int socket_desc;
+
+	if(sms_unix_address(agent, &agent_address, &agent_address_length) != 1)
+	{
+		verbose_print(", %s(), line %d] Invalid agent endpoint %s\n",  __func__, __LINE__, agent);
+		return -1;
+	}
+
+	request_length = snprintf(request, sizeof(request), "%s\n%s\n", server, port);
+	if(request_length < 0 || request_length >= (int) sizeof(request))
+	{
+		return -1;
+	}
+
+	agent_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(agent_desc == -1)
+	{
+		return -1;
+	}
+	/* a busy or stuck agent must not hold up the client run, it connects directly then */
+	if(set_socket_timeout(agent_desc, AGENT_REPLY_TIMEOUT_MS) == -1
+			|| connect(agent_desc, (struct sockaddr *) &agent_address, agent_address_length) == -1)
+	{
+		verbose_print(", %s(), line %d] No agent at %s - %s\n",  __func__, __LINE__, agent, strerror(errno));
+		close(agent_desc);
+		return -1;
+	}
+	/* an abstract socket (unix:@name) has no file permissions, anyone can bind it */
+	if(sms_peer_is_own_user(agent_desc) != 1)
+	{
+		fprintf(stderr, "%s: agent %s belongs to another user, connecting directly\n", prg_name, agent);
+		close(agent_desc);
+		return -1;
+	}
+	/* an agent that went away must not terminate the client run with SIGPIPE */
+	if(send(agent_desc, request, (size_t) request_length, MSG_NOSIGNAL) != request_length)
+	{
+		verbose_print(", %s(), line %d] Agent at %s went away - %s\n",  __func__, __LINE__, agent, strerror(errno));
+		close(agent_desc);
+		return -1;
+	}
+
+	/* agent closes the connection without descriptor if it could not connect,
+	 * the receive timeout applies if it does not answer at all */
+	socket_desc = sms_receive_fd(agent_desc);
+	close(agent_desc);
+	verbose_print(", %s(), line %d] Socket from agent: %d\n",  __func__, __LINE__, socket_desc);
+
+	return socket_desc;
+}
+/**
+ *
+ * \brief run_agent function runs the client agent
+ *
+ * The agent caches getaddrinfo() results and keeps AGENT_WARM connected sockets per
+ * server. A client run asks for a server with "<server>\n<port>\n" and gets a connected
+ * socket passed back (SCM_RIGHTS); it then sends the message itself as usual.
+ *
+ * The agent serves one client run at a time, so nothing may block it for long: connects
+ * time out after AGENT_CONNECT_TIMEOUT_MS, reading and answering a client run after
+ * AGENT_IO_TIMEOUT_MS, and a failing accept() (e.g. out of descriptors) is retried after
+ * a growing pause instead of immediately. Client runs of other users are refused, which
+ * matters for abstract sockets (unix:@name) without file permissions.
+ *
+ * Warm connections are not free for the server: it forks a business logic process for
+ * every connection it accepts, and that process waits for the request, so each idle warm
+ * connection holds one. A TCP server also sets TCP_DEFER_ACCEPT, i.e. the kernel holds an
+ * idle connection back until data arrives or DEFER_ACCEPT_SECONDS have passed; a warm
+ * connection older than that is accepted without data, its request cannot be checked
+ * before the fork, and it keeps a process waiting until it is used.
+ *
+ * \param endpoint passes the unix domain socket to listen on (unix:/path)
+ *
+ * \return EXIT_FAILURE if the agent could not be started (otherwise it does not return)
+ *
+ */
+int run_agent(const char *endpoint)
+{
+	struct sockaddr_un agent_address;
+	socklen_t agent_address_length;
+	struct agent_pool *pool;
+	char request[NI_MAXHOST + NI_MAXSERV + 2];
+	char *port;
+	char *end;
+	size_t request_length;
+	ssize_t bytes_read;
+	int listen_desc;
+	int client_desc;
+	int socket_desc;
+	long accept_backoff_ms = AGENT_ACCEPT_BACKOFF_MS;
+	struct timespec delay;
+
+	if(sms_unix_address(endpoint, &agent_address, &agent_address_length) != 1)
+	{
+		fprintf(stderr, "%s: agent endpoint has to be unix:/path\n", prg_name);
 		return EXIT_FAILURE;
 	}
-	verbose_print(", %s(), line %d] Client_Socket is open.\n",  __func__, __LINE__);
-	mode = 0;
-	
-	/*read characters from stream and store them into receive_buffer*/
-	while(fgets(receive_buffer, MAXIMUM_SIZE, client_socket) != NULL)
+
+	listen_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_desc == -1)
 	{
-		switch(mode)
+		fprintf(stderr, "%s: Cannot create socket - %s\n", prg_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	/* a socket file left by an agent that is gone is replaced, anything else is kept */
+	if(sms_remove_stale_socket(&agent_address, agent_address_length) == -1)
+	{
+		fprintf(stderr, "%s: Cannot use %s - %s\n", prg_name, endpoint, strerror(errno));
+		close(listen_desc);
+		return EXIT_FAILURE;
+	}
+	if(bind(listen_desc, (struct sockaddr *) &agent_address, agent_address_length) == -1
+			|| listen(listen_desc, SOMAXCONN) == -1)
+	{
+		fprintf(stderr, "%s: Cannot listen on %s - %s\n", prg_name, endpoint, strerror(errno));
+		close(listen_desc);
+		return EXIT_FAILURE;
+	}
+
+	/* a client run which went away must not terminate the agent */
+	signal(SIGPIPE, SIG_IGN);
+	connect_timeout_ms = AGENT_CONNECT_TIMEOUT_MS;
+
+	for(;;)
+	{
+		client_desc = accept(listen_desc, NULL, NULL);
+		if(client_desc == -1)
 		{
-		case 0:
-		
-			/*check if "status=" was received*/
-			if(check_stream(receive_buffer, "status=", value) == 0)
+			/* the connection stays queued on EMFILE and the like - wait instead of spinning */
+			if(errno != EINTR && errno != ECONNABORTED)
 			{
-				verbose_print(", %s(), line %d] Status was received. \n",  __func__, __LINE__);
-				/*store received status into status variable*/
-				if(sscanf(receive_buffer,"status=%d",&status) == 0)
-				{
-					fprintf(stderr, "Failed to retrieve status. %s", strerror(errno));
-					my_close(client_socket);
-					return EXIT_FAILURE;
-				}
-				/*if status = 0 go ahead*/
-				if(status == 0)
-				{
-					mode = 1;
-				}
-				else
+				fprintf(stderr, "%s: accept failed - %s, retrying in %ld ms\n", prg_name, strerror(errno), accept_backoff_ms);
+				delay.tv_sec = accept_backoff_ms / 1000;
+				delay.tv_nsec = (accept_backoff_ms % 1000) * 1000000L;
+				while(nanosleep(&delay, &delay) == -1 && errno == EINTR)
 				{
-					verbose_print(", %s(), line %d] Status: %d is invalid\n",  __func__, __LINE__, status);
-					my_close(client_socket);
-					fprintf(stderr, "Wrong status");
+					/* sleep the rest */
 				}
+				accept_backoff_ms = (accept_backoff_ms * 2 > AGENT_ACCEPT_BACKOFF_MAX_MS) ? AGENT_ACCEPT_BACKOFF_MAX_MS
+						: accept_backoff_ms * 2;
 			}
-			break;
-		case 1:
-			/*check if file was received*/
-			if(check_stream(receive_buffer, "file=", value) == 0)
+			continue;
+		}
+		accept_backoff_ms = AGENT_ACCEPT_BACKOFF_MS;
+
+		/* warm sockets are only passed to client runs of the same user */
+		if(sms_peer_is_own_user(client_desc) != 1)
+		{
+			fprintf(stderr, "%s: refusing client run of another user\n", prg_name);
+			close(client_desc);
+			continue;
+		}
+
+		/* a client run that does not send its request must not block the agent */
+		if(set_socket_timeout(client_desc, AGENT_IO_TIMEOUT_MS) == -1)
+		{
+			close(client_desc);
+			continue;
+		}
+
+		/* read "<server>\n<port>\n" */
+		request_length = 0;
+		port = NULL;
+		end = NULL;
+		while(end == NULL && request_length < sizeof(request) - 1)
+		{
+			bytes_read = read(client_desc, request + request_length, sizeof(request) - 1 - request_length);
+			if(bytes_read <= 0)
 			{
-				verbose_print(", %s(), line %d] File was received. \n",  __func__, __LINE__);
-				/*try to open a new file for writing*/
-				write_to = fopen(value, "w");
-				if(write_to == NULL)
+				break;
+			}
+			request_length += (size_t) bytes_read;
+			request[request_length] = '\0';
+
+			port = strchr(request, '\n');
+			if(port != NULL)
+			{
+				end = strchr(port + 1, '\n');
+			}
+		}
+
+		if(end != NULL)
+		{
+			*port++ = '\0';
+			*end = '\0';
+
+			pool = agent_find_pool(request, port);
+			socket_desc = agent_take_connection(pool);
+			if(socket_desc != -1)
+			{
+				if(sms_send_fd(client_desc, socket_desc) == -1)
 				{
-					fprintf(stderr, "Unable to open file - %s\n",  strerror(errno));
-					verbose_print(", %s(), line %d] Unable to open file: %s\n",  __func__, __LINE__, value);
-					my_close(client_socket);
-					return EXIT_FAILURE;
+					fprintf(stderr, "%s: Cannot pass socket - %s\n", prg_name, strerror(errno));
 				}
-				mode = 2;
+				close(socket_desc);
 			}
-			else
+			close(client_desc);
+
+			/* connect the next sockets while no client run is waiting */
+			while(pool->warm_count < AGENT_WARM && (socket_desc = agent_connect(pool)) != -1)
 			{
-				mode = 4;
+				pool->warm[pool->warm_count++] = socket_desc;
 			}
+			continue;
+		}
 
+		close(client_desc);
+	}
+}
+/**
+ *
+ * \brief agent_find_pool function returns the pool of a server endpoint, resolving its address if needed
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ *
+ * \return pool of the server endpoint (the least recently created one is reused when all are taken)
+ *
+ */
+struct agent_pool *agent_find_pool(const char *server, const char *port)
+{
+	static struct agent_pool pools[AGENT_POOLS];
+	static int pool_count = 0;
+	static int next_reused = 0;
+	struct agent_pool *pool = NULL;
+	struct addrinfo client_info;
+	struct sockaddr_un unix_address;
+	socklen_t unix_address_length;
+	int i;
+
+	for(i = 0; i < pool_count; i++)
+	{
+		if(strcmp(pools[i].server, server) == 0 && strcmp(pools[i].port, port) == 0)
+		{
+			pool = &pools[i];
 			break;
-		case 2:
-			/*check if "len=" was received*/
-			if(check_stream(receive_buffer, "len=", value) == 0)
+		}
+	}
+
+	if(pool == NULL)
+	{
+		if(pool_count < AGENT_POOLS)
+		{
+			pool = &pools[pool_count++];
+		}
+		else
+		{
+			pool = &pools[next_reused];
+			next_reused = (next_reused + 1) % AGENT_POOLS;
+			while(pool->warm_count > 0)
 			{
-				verbose_print(", %s(), line %d] Length was received \n",  __func__, __LINE__);
-				/* get file length */
-				if(sscanf(value, "%d", &file_length_received) == 0)
-				{
-					fprintf(stderr, "Error converting file length to integer - %s\n",  strerror(errno));
-					verbose_print(", %s(), line %d] File length could not be read\n",  __func__, __LINE__);
-					my_close(client_socket);
-					my_close(write_to);
-					return EXIT_FAILURE;
-				}
-				/*switch to next check*/
-				mode = 3;
+				close(pool->warm[--pool->warm_count]);
 			}
-			else
+			if(pool->addresses != NULL)
 			{
-				mode = 4;
+				freeaddrinfo(pool->addresses);
 			}
+		}
+		memset(pool, 0, sizeof(*pool));
+		snprintf(pool->server, sizeof(pool->server), "%s", server);
+		snprintf(pool->port, sizeof(pool->port), "%s", port);
+	}
+
+	/* unix:/path needs no name resolution */
+	if(sms_unix_address(server, &unix_address, &unix_address_length) != 0)
+	{
+		return pool;
+	}
+
+	if(pool->addresses != NULL && time(NULL) - pool->resolved > AGENT_DNS_SECONDS)
+	{
+		freeaddrinfo(pool->addresses);
+		pool->addresses = NULL;
+	}
+	if(pool->addresses == NULL)
+	{
+		memset(&client_info, 0, sizeof(client_info));
+		client_info.ai_family = AF_UNSPEC;
+		client_info.ai_socktype = SOCK_STREAM;
+		if(getaddrinfo(server, port, &client_info, &pool->addresses) != 0)
+		{
+			pool->addresses = NULL;
+		}
+		pool->resolved = time(NULL);
+	}
+
+	return pool;
+}
+/**
+ *
+ * \brief agent_connect function opens a new connection to the server of a pool
+ *
+ * \param pool passes the pool of the server endpoint
+ *
+ * \return connected socket descriptor
+ * \return -1 on error
+ *
+ */
+int agent_connect(struct agent_pool *pool)
+{
+	if(pool->addresses == NULL)
+	{
+		return connect_server(pool->server, pool->port);
+	}
+
+	return connect_addresses(pool->addresses);
+}
+/**
+ *
+ * \brief agent_take_connection function takes a warm connection out of the pool or connects
+ *
+ * Warm sockets the server has closed or reset in the meantime are dropped.
+ *
+ * \param pool passes the pool of the server endpoint
+ *
+ * \return connected socket descriptor
+ * \return -1 on error
+ *
+ */
+int agent_take_connection(struct agent_pool *pool)
+{
+	char peek;
+	int socket_desc;
+
+	while(pool->warm_count > 0)
+	{
+		socket_desc = pool->warm[--pool->warm_count];
+		/* nothing to read and no EOF - connection is still usable */
+		if(recv(socket_desc, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			return socket_desc;
+		}
+		close(socket_desc);
+	}
+
+	return agent_connect(pool);
+}
+/**
+ *
+ * \brief send_message function sends user, message and if chosen by user an image
+ *
+ * \param socket_desc passes the socket_descriptor
+ * \param user passes the user who sends the message
+ * \param message passes the message to written to the bulletin board
+ * \param image passes the image URL to be shown in the bulletin board
+ *
+ * \return EXIT_SUCCESS when no error occurs
+ * \return EXIT_FAILURE on error
+ *
+ */
+int send_message(int socket_desc, const char *user, const char *message, const char *image)
+{
+
+	int send_message;
+	int flush_check;
+	int response_desc;
+	FILE *message_desc = NULL;
+
+
+		/*open file and associate it to the stream socket -writing mode - stream is positioned at beginning of the file*/
+		message_desc = fdopen(socket_desc, "w");
+		if(message_desc == NULL)
+		{
+			fprintf(stderr, "%s: failed open file for message %s\n", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+
+		verbose_print(", %s(), line %d] Sent request user =\"%s\"\n",  __func__, __LINE__, user);
+
+		/*user field is required - don't have to check again if username was entered*/
+		/*check message data and send*/
+		/* send the header to the stream */
+		send_message = fprintf(message_desc,"user=%s\n", user);
+		/* ask for compressed file= records - not when records are passed on unchanged with --stdout */
+		if(send_message != -1 && compress_response == 1 && output_fd == -1)
+		{
+			send_message = fprintf(message_desc,"%s\n", ACCEPT_ENCODING);
+		}
+		/*only send image tag if image was given*/
+		if(send_message != -1 && image_file != NULL)
+		{
+			verbose_print(", %s(), line %d] imgfile=\"%s\n",  __func__,__LINE__, image_file);
+			/* local image is uploaded as a file=/len= like record after the user line */
+			send_message = stream_image(message_desc, socket_desc, image_file);
+		}
+		/*message is required - send image and message if image is given*/
+		else if(send_message != -1 && image != NULL)
+		{
+			verbose_print(", %s(), line %d] img=\"%s\n",  __func__,__LINE__, image);
+			send_message = fprintf(message_desc,"img=%s\n", image);
+		}
+		if (send_message == -1)
+		{
+			fprintf(stderr, "%s: failed to send message - %s\n", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+
+		/* "-m -" streams the message from stdin or --message-file instead of the command line */
+		if(strcmp(message, STREAM_MESSAGE) == 0)
+		{
+			verbose_print(", %s(), line %d] message from \"%s\"\n", __func__, __LINE__,
+					message_file == NULL ? "stdin" : message_file);
+			/* header has to be on the socket before the body is written to the descriptor */
+			if(fflush(message_desc) != 0 || stream_message(socket_desc, message_file) == -1)
+			{
+				fprintf(stderr, "%s: failed to send message - %s\n", prg_name, strerror(errno));
+				my_close(message_desc);
+				return EXIT_FAILURE;
+			}
+			send_message = fprintf(message_desc,"\n");
+		}
+		else
+		{
+			verbose_print(", %s(), line %d] message =\"%s\n", __func__, __LINE__,message);
+			send_message = fprintf(message_desc,"%s\n", message);
+		}
+		if (send_message == -1)
+		{
+			fprintf(stderr, "%s: failed to send message - %s\n", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+
+		/*write all unwritten data to the file/socket */
+		flush_check = fflush(message_desc);
+		if (flush_check != 0)
+		{
+			fprintf(stderr, "%s: failed to flush socket - %s\n", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+
+		/*block further sending, receiving is still possible with SHUT_WR */
+		if(shutdown(socket_desc, SHUT_WR) != 0)
+		{
+			fprintf(stderr, "%s: failed to close writing direction - %s\n", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+		verbose_print(", %s(), line %d] Shutdown \n",  __func__, __LINE__);
+
+		/* receive_response() closes the descriptor it reads from, message_desc closes socket_desc */
+		response_desc = dup(socket_desc);
+		if(response_desc == -1 || receive_response(response_desc) != EXIT_SUCCESS)
+		{
+			fprintf(stderr, "%s failed to read response - %s", prg_name, strerror(errno));
+			my_close(message_desc);
+			return EXIT_FAILURE;
+		}
+
+	my_close(message_desc);
+
+	return EXIT_SUCCESS;
+
+}
+/**
+ *
+ * \brief stream_message function copies the message from a file or stdin to the socket
+ *
+ * Regular files are sent with sendfile(), everything else is copied in chunks, so the
+ * memory used does not depend on the size of the message.
+ *
+ * \param socket_desc passes the socket descriptor
+ * \param path passes the file to send, NULL for stdin
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int stream_message(int socket_desc, const char *path)
+{
+	static char stream_buffer[STREAM_CHUNK_SIZE];
+	struct stat file_status;
+	ssize_t bytes_read;
+	ssize_t bytes_written;
+	int message_fd = STDIN_FILENO;
+	int check = 0;
+
+	if(path != NULL)
+	{
+		message_fd = open(path, O_RDONLY);
+		if(message_fd == -1)
+		{
+			fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, path, strerror(errno));
+			return -1;
+		}
+	}
+
+	if(fstat(message_fd, &file_status) == 0 && S_ISREG(file_status.st_mode))
+	{
+		/* kernel copies the file to the socket, nothing passes through user space */
+		while((bytes_written = sendfile(socket_desc, message_fd, NULL, STREAM_CHUNK_SIZE * 16)) > 0);
+		if(bytes_written == -1)
+		{
+			check = -1;
+		}
+	}
+	else
+	{
+		while(check == 0 && (bytes_read = read(message_fd, stream_buffer, sizeof(stream_buffer))) != 0)
+		{
+			if(bytes_read == -1)
+			{
+				if(errno != EINTR)
+				{
+					check = -1;
+				}
+				continue;
+			}
+			check = sms_write_all(socket_desc, stream_buffer, (size_t) bytes_read);
+		}
+	}
+
+	if(path != NULL)
+	{
+		close(message_fd);
+	}
+
+	return check;
+}
+/**
+ *
+ * \brief stream_image function uploads a local image as imgfile=<name>, len=<length> record
+ *
+ * \param message_desc passes the stream the header is written to
+ * \param socket_desc passes the socket descriptor the image is sent to with sendfile()
+ * \param path passes the image file
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int stream_image(FILE *message_desc, int socket_desc, const char *path)
+{
+	struct stat file_status;
+	const char *name;
+	off_t remaining;
+	ssize_t bytes_written;
+	int image_fd;
+
+	image_fd = open(path, O_RDONLY);
+	if(image_fd == -1)
+	{
+		fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, path, strerror(errno));
+		return -1;
+	}
+	if(fstat(image_fd, &file_status) == -1 || !S_ISREG(file_status.st_mode))
+	{
+		fprintf(stderr, "%s: %s is no regular file\n", prg_name, path);
+		close(image_fd);
+		return -1;
+	}
+
+	/* only the file name is sent, the server uses it for the extension */
+	name = strrchr(path, '/');
+	name = (name == NULL) ? path : name + 1;
+
+	if(fprintf(message_desc, "imgfile=%s\nlen=%lld\n", name, (long long) file_status.st_size) < 0
+			|| fflush(message_desc) != 0)
+	{
+		close(image_fd);
+		return -1;
+	}
+
+	/* the server has to accept the upload before the image is sent */
+	if(wait_for_continue(socket_desc) == -1)
+	{
+		close(image_fd);
+		return -1;
+	}
+
+	/* exactly len bytes, even if the file changes in the meantime */
+	for(remaining = file_status.st_size; remaining > 0; remaining -= bytes_written)
+	{
+		bytes_written = sendfile(socket_desc, image_fd, NULL, (size_t) remaining);
+		if(bytes_written <= 0)
+		{
+			fprintf(stderr, "%s: failed to send %s - %s\n", prg_name, path, bytes_written == 0 ? "file truncated" : strerror(errno));
+			close(image_fd);
+			return -1;
+		}
+	}
+
+	close(image_fd);
+	return 0;
+}
+/**
+ *
+ * \brief wait_for_continue function waits until the server accepts an image upload
+ *
+ * The server answers the imgfile= and len= lines with CONTINUE_LINE, or with an error
+ * status if it does not accept uploads or the image is too large. A server that sends
+ * nothing within CONTINUE_TIMEOUT_MS does not know uploads; the connection is reset then,
+ * so the lines already sent never reach the business logic as a post.
+ *
+ * \param socket_desc passes the socket descriptor
+ *
+ * \return 0 if the image can be sent
+ * \return -1 if the upload was refused or the server did not answer
+ *
+ */
+int wait_for_continue(int socket_desc)
+{
+	struct pollfd poll_desc;
+	struct linger reset = { 1, 0 };
+	char line[MAXIMUM_SIZE];
+	size_t line_length = 0;
+	ssize_t bytes_read;
+	int check;
+
+	poll_desc.fd = socket_desc;
+	poll_desc.events = POLLIN;
+	do
+	{
+		check = poll(&poll_desc, 1, CONTINUE_TIMEOUT_MS);
+	} while(check == -1 && errno == EINTR);
+	if(check == 0)
+	{
+		fprintf(stderr, "%s: server does not accept image uploads\n", prg_name);
+		setsockopt(socket_desc, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	/* byte by byte - nothing after the line must be taken from the socket */
+	while(line_length < sizeof(line) - 1)
+	{
+		bytes_read = read(socket_desc, line + line_length, 1);
+		if(bytes_read == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes_read <= 0)
+		{
+			break;
+		}
+		line_length++;
+		if(line[line_length - 1] == '\n')
+		{
+			break;
+		}
+	}
+	line[line_length] = '\0';
+
+	if(strcmp(line, CONTINUE_LINE) != 0)
+	{
+		fprintf(stderr, "%s: server refused the image upload (no image store or image too large)\n", prg_name);
+		errno = EPERM;
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief receive_response function receives the servers response
+ *
+ * \param socket_desc passes the socket descriptor
+ *
+ * \return EXIT_SUCCESS when no error occurs
+ * \return EXIT_FAILURE on error
+ *
+ */
+int receive_response(int socket_desc)
+{
+	FILE *client_socket;
+	struct response_file response = { .open = 0 };
+
+	int mode;
+	
+	char receive_buffer[MAXIMUM_SIZE];
+	char value[MAXIMUM_SIZE];
+	int file_length_received = 0;
+	int maximum_buffer = 0;
+	int count = 0;
+	int bytes_received = 0;
+	int bytes_read = 0;
+	int check_write;
+	int record_deflate = 0;
+
+
+	/*open the file for reading*/
+	client_socket = fdopen(socket_desc, "r");
+	if(client_socket == NULL)
+	{
+		fprintf(stderr, "%s: failed to open socket for reading - %s\n", prg_name,  strerror(errno));
+		/* no leaks if socket is not closed, but we do it to be on the safe side */
+		my_close(client_socket);
+		return EXIT_FAILURE;
+	}
+	verbose_print(", %s(), line %d] Client_Socket is open.\n",  __func__, __LINE__);
+	mode = 0;
+
+	/* payloads are spliced from the socket, so stdio must not read ahead of the header lines */
+	if(output_fd != -1 && setvbuf(client_socket, NULL, _IONBF, 0) != 0)
+	{
+		fprintf(stderr, "%s: failed to set up socket stream - %s\n", prg_name, strerror(errno));
+		my_close(client_socket);
+		return EXIT_FAILURE;
+	}
+	
+	/*read characters from stream and store them into receive_buffer*/
+	while(fgets(receive_buffer, MAXIMUM_SIZE, client_socket) != NULL)
+	{
+		switch(mode)
+		{
+		case 0:
+		
+			/*check if "status=" was received*/
+			if(check_stream(receive_buffer, "status=", value) == 0)
+			{
+				verbose_print(", %s(), line %d] Status was received. \n",  __func__, __LINE__);
+				/*store received status into status variable*/
+				if(sscanf(receive_buffer,"status=%d",&status) == 0)
+				{
+					fprintf(stderr, "Failed to retrieve status. %s", strerror(errno));
+					my_close(client_socket);
+					return EXIT_FAILURE;
+				}
+				/*if status = 0 go ahead*/
+				if(status == 0)
+				{
+					mode = 1;
+				}
+				else
+				{
+					verbose_print(", %s(), line %d] Status: %d is invalid\n",  __func__, __LINE__, status);
+					my_close(client_socket);
+					fprintf(stderr, "Wrong status");
+					return EXIT_FAILURE;
+				}
+			}
+			break;
+		case 1:
+			/*check if file was received*/
+			if(check_stream(receive_buffer, "file=", value) == 0)
+			{
+				verbose_print(", %s(), line %d] File was received. \n",  __func__, __LINE__);
+				/*try to open a new file for writing*/
+				if(response_open(&response, value) == -1)
+				{
+					fprintf(stderr, "Unable to open file - %s\n",  strerror(errno));
+					verbose_print(", %s(), line %d] Unable to open file: %s\n",  __func__, __LINE__, value);
+					my_close(client_socket);
+					return EXIT_FAILURE;
+				}
+				mode = 2;
+			}
+			else
+			{
+				mode = 4;
+			}
+
+			break;
+		case 2:
+			/* compressed record - only sent by the server if --compress asked for it */
+			if(check_stream(receive_buffer, "encoding=", value) == 0)
+			{
+				if(strcmp(value, ENCODING_DEFLATE) != 0)
+				{
+					fprintf(stderr, "%s: unsupported encoding %s\n", prg_name, value);
+					my_close(client_socket);
+					response_abort(&response);
+					return EXIT_FAILURE;
+				}
+				record_deflate = 1;
+			}
+			/*check if "len=" was received*/
+			else if(check_stream(receive_buffer, "len=", value) == 0)
+			{
+				verbose_print(", %s(), line %d] Length was received \n",  __func__, __LINE__);
+				/* get file length */
+				if(sscanf(value, "%d", &file_length_received) == 0)
+				{
+					fprintf(stderr, "Error converting file length to integer - %s\n",  strerror(errno));
+					verbose_print(", %s(), line %d] File length could not be read\n",  __func__, __LINE__);
+					my_close(client_socket);
+					response_abort(&response);
+					return EXIT_FAILURE;
+				}
+				/*switch to next check*/
+				mode = 3;
+			}
+			else
+			{
+				mode = 4;
+			}
+
+			break;
+			/* if looked for values were not found with check_stream */
+		case 4:
+			my_close(client_socket);
+			response_abort(&response);
+			return EXIT_SUCCESS;
+			break;
+		default:
+			if(response.open == 0)
+			{
+				fprintf(stderr, "Something went wrong - no file was opened - %s\n",  strerror(errno));
+				verbose_print(", %s(), line %d] No file was opened\n",  __func__, __LINE__);
+				my_close(client_socket);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if(mode == 3 && record_deflate == 1)
+		{
+			if(inflate_record(client_socket, &response, file_length_received) == -1)
+			{
+				fprintf(stderr, "%s: failed to decompress %s\n", prg_name, response.name);
+				my_close(client_socket);
+				response_abort(&response);
+				return EXIT_FAILURE;
+			}
+			if(response_close(&response) == -1)
+			{
+				my_close(client_socket);
+				return EXIT_FAILURE;
+			}
+			record_deflate = 0;
+			/* Next record */
+			mode = 1;
+		}
+
+		if(mode == 3 && output_fd != -1)
+		{
+			if(stream_record(socket_desc, response.name, file_length_received) == -1)
+			{
+				fprintf(stderr, "%s: failed to stream %s - %s\n", prg_name, response.name, strerror(errno));
+				my_close(client_socket);
+				return EXIT_FAILURE;
+			}
+			response_close(&response);
+			/* Next record */
+			mode = 1;
+		}
+
+		if(mode == 3)
+		{
+			bytes_read = 0;
+			bytes_received=0;
+
+			while(1)
+			{
+				/* only for logging */
+				count++;
+
+				/* never read beyond the record - the next record follows directly */
+				if(MAXIMUM_SIZE < (file_length_received - bytes_received))
+				{
+					maximum_buffer = MAXIMUM_SIZE;
+				}
+				else
+				{
+					maximum_buffer = file_length_received - bytes_received;
+				}
+				verbose_print(", %s(), line %d] Read part: %d byte %d\n",  __func__, __LINE__, count, maximum_buffer);
+
+				/* read data from the socket */
+				bytes_read = fread(receive_buffer, sizeof(char), maximum_buffer, client_socket);
+				verbose_print(", %s(), line %d] Bytes_read called",  __func__, __LINE__);
+				bytes_received = bytes_received + bytes_read;
+
+				/* write to file */
+				check_write = response_write(&response, receive_buffer, bytes_read);
+				/* if not as many bytes were read as written, an error occurs */
+				if (check_write != bytes_read)
+				{
+					my_close(client_socket);
+					response_abort(&response);
+					fprintf(stderr, "Error writing to file");
+					return EXIT_FAILURE;
+				}
+				/* error handling for fwrite */
+				if(check_write < bytes_read)
+				{
+					my_close(client_socket);
+					response_abort(&response);
+					fprintf(stderr, "Error in fwrite");
+					return EXIT_FAILURE;
+				}
+
+
+				/* if the received bytes are the same as the file length, check if there is 
+				* another record and close file to write to*/
+				if(bytes_received >= file_length_received)
+				{
+					if(response_close(&response) == -1)
+					{
+						my_close(client_socket);
+						return EXIT_FAILURE;
+					}
+					/* Next record */
+					mode = 1;
+					break;
+				}
+
+				/* if there was a reading error or the response ended early, break */
+				if(ferror(client_socket) != 0 || feof(client_socket) != 0)
+				{
+					response_abort(&response);
+					my_close(client_socket);
+					fprintf(stderr, "Error reading from stream");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+	my_close(client_socket);
+	verbose_print(", %s(), line %d] EOF reached \n",  __func__, __LINE__);
+
+
+	return EXIT_SUCCESS;
+
+}
+/**
+ *
+ * \brief response_open function opens the file a file= record of the response is written to
+ *
+ * In --dedupe mode nothing is written yet: the payload is compared with the existing
+ * file and only written (to a temporary file renamed on close) once it differs.
+ *
+ * \param response returns the opened response file
+ * \param name passes the file name sent by the server
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int response_open(struct response_file *response, const char *name)
+{
+	int length;
+
+	length = snprintf(response->name, sizeof(response->name), "%s", name);
+	if(length < 0 || (size_t) length >= sizeof(response->name))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	response->temp_name[0] = '\0';
+	response->write_to = NULL;
+	response->existing = NULL;
+	response->matched = 0;
+
+	/* records are streamed to output_fd, no file is opened */
+	if(output_fd != -1)
+	{
+		response->open = 1;
+		return 0;
+	}
+
+	if(dedupe == 0)
+	{
+		response->write_to = fopen(name, "w");
+	}
+	else
+	{
+		/* no existing file - nothing to compare with */
+		response->existing = fopen(name, "r");
+		if(response->existing == NULL)
+		{
+			response_create_temp(response);
+		}
+	}
+
+	if(response->write_to == NULL && response->existing == NULL)
+	{
+		return -1;
+	}
+	response->open = 1;
+	return 0;
+}
+/**
+ *
+ * \brief response_create_temp function creates the temporary file of a changed response file
+ *
+ * The part of the payload which matched the existing file so far is copied from there.
+ *
+ * \param response passes the response file
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int response_create_temp(struct response_file *response)
+{
+	char copy_buffer[MAXIMUM_SIZE];
+	long remaining = response->matched;
+	size_t chunk;
+	int temp_fd;
+	mode_t mask;
+
+	snprintf(response->temp_name, sizeof(response->temp_name), "%s%s", response->name, TEMP_SUFFIX);
+	temp_fd = mkstemp(response->temp_name);
+	if(temp_fd == -1)
+	{
+		response->temp_name[0] = '\0';
+		return -1;
+	}
+	/* same permissions as fopen(name, "w") would have given */
+	mask = umask(0);
+	umask(mask);
+	fchmod(temp_fd, 0666 & ~mask);
+
+	response->write_to = fdopen(temp_fd, "w");
+	if(response->write_to == NULL)
+	{
+		close(temp_fd);
+		return -1;
+	}
+
+	if(response->existing != NULL)
+	{
+		rewind(response->existing);
+		while(remaining > 0)
+		{
+			chunk = (remaining < (long) sizeof(copy_buffer)) ? (size_t) remaining : sizeof(copy_buffer);
+			if(fread(copy_buffer, 1, chunk, response->existing) != chunk
+					|| fwrite(copy_buffer, 1, chunk, response->write_to) != chunk)
+			{
+				return -1;
+			}
+			remaining -= (long) chunk;
+		}
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief response_write function writes a part of the payload of a file= record
+ *
+ * \param response passes the response file
+ * \param buffer passes the received data
+ * \param length passes the number of bytes received
+ *
+ * \return number of bytes written (length when no error occurs)
+ *
+ */
+int response_write(struct response_file *response, const char *buffer, int length)
+{
+	char compare_buffer[MAXIMUM_SIZE];
+
+	/* still the same bytes as in the existing file - nothing to write */
+	if(response->write_to == NULL)
+	{
+		if(length <= MAXIMUM_SIZE
+				&& fread(compare_buffer, 1, (size_t) length, response->existing) == (size_t) length
+				&& memcmp(compare_buffer, buffer, (size_t) length) == 0)
+		{
+			response->matched += length;
+			return length;
+		}
+		if(response_create_temp(response) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return (int) fwrite(buffer, sizeof(char), length, response->write_to);
+}
+/**
+ *
+ * \brief response_close function closes a response file when its payload was received completely
+ *
+ * In --dedupe mode an unchanged file is left alone, otherwise the temporary file
+ * replaces it atomically. The result is reported as unchanged, updated or new.
+ *
+ * \param response passes the response file
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int response_close(struct response_file *response)
+{
+	const char *result = "updated";
+
+	if(response->open == 0)
+	{
+		return 0;
+	}
+	response->open = 0;
+
+	if(output_fd != -1)
+	{
+		return 0;
+	}
+
+	if(dedupe == 0)
+	{
+		my_close(response->write_to);
+		return 0;
+	}
+
+	/* all bytes matched - unchanged unless the existing file is longer */
+	if(response->write_to == NULL)
+	{
+		if(fgetc(response->existing) == EOF)
+		{
+			my_close(response->existing);
+			fprintf(report_stream(), "%s: unchanged\n", response->name);
+			return 0;
+		}
+		if(response_create_temp(response) == -1)
+		{
+			response->open = 1;
+			response_abort(response);
+			return -1;
+		}
+	}
+
+	if(response->existing == NULL)
+	{
+		result = "new";
+	}
+	else
+	{
+		my_close(response->existing);
+	}
+
+	if(fclose(response->write_to) != 0 || rename(response->temp_name, response->name) == -1)
+	{
+		fprintf(stderr, "%s: cannot write %s - %s\n", prg_name, response->name, strerror(errno));
+		unlink(response->temp_name);
+		return -1;
+	}
+
+	fprintf(report_stream(), "%s: %s\n", response->name, result);
+	return 0;
+}
+/**
+ *
+ * \brief response_abort function closes a response file after an error
+ *
+ * A temporary file of --dedupe mode is removed, the existing file stays as it was.
+ *
+ * \param response passes the response file
+ *
+ */
+void response_abort(struct response_file *response)
+{
+	if(response->open == 0)
+	{
+		return;
+	}
+	response->open = 0;
+
+	if(response->existing != NULL)
+	{
+		fclose(response->existing);
+	}
+	if(response->write_to != NULL)
+	{
+		fclose(response->write_to);
+	}
+	if(response->temp_name[0] != '\0')
+	{
+		unlink(response->temp_name);
+	}
+}
+/**
+ *
+ * \brief stream_record function writes a file= record of the response to output_fd
+ *
+ * The record keeps the framing of the response ("file=<name>\nlen=<length>\n" and the
+ * payload). If output_fd is a pipe the payload is spliced from the socket without
+ * passing through user space, so the reader can start before the download finished.
+ *
+ * \param socket_desc passes the socket descriptor (the stream must be unbuffered)
+ * \param name passes the file name sent by the server
+ * \param length passes the length of the payload
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int stream_record(int socket_desc, const char *name, int length)
+{
+	char copy_buffer[STREAM_CHUNK_SIZE];
+	char header[MAXIMUM_SIZE + sizeof("file=\nlen=\n") + 12];
+	int header_length;
+	int splice_supported = 1;
+	size_t remaining = (size_t) length;
+	ssize_t bytes_moved;
+
+	header_length = snprintf(header, sizeof(header), "file=%s\nlen=%d\n", name, length);
+	if(sms_write_all(output_fd, header, (size_t) header_length) == -1)
+	{
+		return -1;
+	}
+
+	while(remaining > 0)
+	{
+		if(splice_supported == 1)
+		{
+			bytes_moved = splice(socket_desc, NULL, output_fd, NULL, remaining, SPLICE_F_MOVE | SPLICE_F_MORE);
+			/* output is no pipe - copy */
+			if(bytes_moved == -1 && errno == EINVAL)
+			{
+				splice_supported = 0;
+				continue;
+			}
+		}
+		else
+		{
+			bytes_moved = read(socket_desc, copy_buffer, remaining < sizeof(copy_buffer) ? remaining : sizeof(copy_buffer));
+			if(bytes_moved > 0 && sms_write_all(output_fd, copy_buffer, (size_t) bytes_moved) == -1)
+			{
+				return -1;
+			}
+		}
+
+		if(bytes_moved == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes_moved <= 0)
+		{
+			/* connection closed before the whole payload was received */
+			if(bytes_moved == 0)
+			{
+				errno = EPIPE;
+			}
+			return -1;
+		}
+		remaining -= (size_t) bytes_moved;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief inflate_record function decompresses the payload of an encoding=deflate record while it is received
+ *
+ * Only one chunk of compressed and decompressed data is held in memory at a time.
+ *
+ * \param client_socket passes the socket stream
+ * \param response passes the response file the decompressed data is written to
+ * \param length passes the length of the compressed payload
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int inflate_record(FILE *client_socket, struct response_file *response, int length)
+{
+	unsigned char compressed[MAXIMUM_SIZE];
+	unsigned char decompressed[MAXIMUM_SIZE];
+	z_stream stream;
+	size_t remaining = (size_t) length;
+	size_t bytes_read;
+	int decompressed_length;
+	int check = Z_OK;
+
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit(&stream) != Z_OK)
+	{
+		return -1;
+	}
+
+	while(remaining > 0 && check != Z_STREAM_END)
+	{
+		bytes_read = fread(compressed, 1, remaining < sizeof(compressed) ? remaining : sizeof(compressed), client_socket);
+		if(bytes_read == 0)
+		{
+			break;
+		}
+		remaining -= bytes_read;
+
+		stream.next_in = compressed;
+		stream.avail_in = (uInt) bytes_read;
+		do
+		{
+			stream.next_out = decompressed;
+			stream.avail_out = sizeof(decompressed);
+			check = inflate(&stream, Z_NO_FLUSH);
+			if(check != Z_OK && check != Z_STREAM_END && check != Z_BUF_ERROR)
+			{
+				inflateEnd(&stream);
+				return -1;
+			}
+			decompressed_length = (int) (sizeof(decompressed) - stream.avail_out);
+			if(decompressed_length > 0 && response_write(response, (char *) decompressed, decompressed_length) != decompressed_length)
+			{
+				inflateEnd(&stream);
+				return -1;
+			}
+		} while(stream.avail_out == 0);
+	}
+
+	inflateEnd(&stream);
+	return (check == Z_STREAM_END && remaining == 0) ? 0 : -1;
+}
+/**
+ *
+ * \brief run_replay function replays a capture file of the server
+ *
+ * Every captured request is sent on its own connection by a forked process at its
+ * original arrival time (scaled by --speed), so concurrency and inter-arrival gaps are
+ * kept. The server writes a record when its request is complete, so the records are
+ * sorted by arrival time first. The latencies are collected in shared memory (in arrival
+ * order) and summarized at the end. Truncated requests are replayed with the bytes that
+ * were captured and counted in the summary.
+ *
+ * \param argc passes the number of arguments left for smc_parsecommandline()
+ * \param argv passes these arguments (-s, -p and -v are used)
+ *
+ * \return EXIT_SUCCESS if all requests got a response
+ * \return EXIT_FAILURE on error
+ *
+ */
+int run_replay(int argc, const char **argv)
+{
+	struct option long_options[] =
+	{
+		{"server", 1, NULL, 's'},
+		{"port", 1, NULL, 'p'},
+		{"verbose", 0, NULL, 'v'},
+		{0, 0, 0, 0}
+	};
+	const struct sms_capture_record **records;
+	const struct sms_capture_record *record;
+	const char *server = NULL;
+	const char *port = NULL;
+	const char *capture;
+	struct stat file_status;
+	struct replay_statistics statistics;
+	struct replay_statistics baseline;
+	struct timespec start;
+	struct timespec next;
+	long long *latencies;
+	long long *baseline_latencies;
+	size_t baseline_count;
+	uint64_t first_arrival;
+	uint64_t offset;
+	long long start_ns;
+	long long next_ns;
+	size_t count = 0;
+	size_t truncated = 0;
+	size_t i;
+	pid_t child;
+	FILE *latency_file;
+	int capture_fd;
+	int option;
+
+	while((option = getopt_long(argc, (char **) argv, "s:p:v", long_options, NULL)) != -1)
+	{
+		switch(option)
+		{
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(stderr, argv[0], EXIT_FAILURE);
+		}
+	}
+	if(server == NULL || port == NULL)
+	{
+		usage(stderr, argv[0], EXIT_FAILURE);
+	}
+
+	/* map the capture, records are read in place */
+	capture_fd = open(replay_path, O_RDONLY);
+	if(capture_fd == -1 || fstat(capture_fd, &file_status) == -1)
+	{
+		fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, replay_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if(file_status.st_size < SMS_CAPTURE_MAGIC_LENGTH)
+	{
+		fprintf(stderr, "%s: %s is no capture file\n", prg_name, replay_path);
+		close(capture_fd);
+		return EXIT_FAILURE;
+	}
+	capture = mmap(NULL, (size_t) file_status.st_size, PROT_READ, MAP_PRIVATE, capture_fd, 0);
+	close(capture_fd);
+	if(capture == MAP_FAILED || memcmp(capture, SMS_CAPTURE_MAGIC, SMS_CAPTURE_MAGIC_LENGTH) != 0)
+	{
+		fprintf(stderr, "%s: %s is no capture file\n", prg_name, replay_path);
+		return EXIT_FAILURE;
+	}
+
+	/* count complete records (the last one may still be written by the server) */
+	for(offset = SMS_CAPTURE_MAGIC_LENGTH; offset + sizeof(*record) <= (uint64_t) file_status.st_size; count++)
+	{
+		record = (const struct sms_capture_record *) (capture + offset);
+		if(offset + sizeof(*record) + SMS_CAPTURE_PADDED(record->length) > (uint64_t) file_status.st_size)
+		{
+			break;
+		}
+		offset += sizeof(*record) + SMS_CAPTURE_PADDED(record->length);
+	}
+	if(count == 0)
+	{
+		fprintf(stderr, "%s: %s contains no requests\n", prg_name, replay_path);
+		return EXIT_FAILURE;
+	}
+
+	/* records are in completion order, the requests are replayed in arrival order */
+	records = malloc(count * sizeof(*records));
+	if(records == NULL)
+	{
+		fprintf(stderr, "%s: malloc failed - %s\n", prg_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	offset = SMS_CAPTURE_MAGIC_LENGTH;
+	for(i = 0; i < count; i++)
+	{
+		records[i] = (const struct sms_capture_record *) (capture + offset);
+		offset += sizeof(*records[i]) + SMS_CAPTURE_PADDED(records[i]->length);
+		if(records[i]->original_length > records[i]->length)
+		{
+			truncated++;
+		}
+	}
+	qsort(records, count, sizeof(*records), compare_arrival);
+	first_arrival = records[0]->arrival_ns;
+
+	/* written by the replaying children */
+	latencies = mmap(NULL, count * sizeof(*latencies), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(latencies == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: mmap failed - %s\n", prg_name, strerror(errno));
+		free(records);
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	start_ns = start.tv_sec * NS_PER_S + start.tv_nsec;
+
+	for(i = 0; i < count; i++)
+	{
+		record = records[i];
+
+		/* wait for the (scaled) arrival time of the request */
+		next_ns = start_ns + (long long) ((double) (record->arrival_ns - first_arrival) / replay_speed);
+		next.tv_sec = next_ns / NS_PER_S;
+		next.tv_nsec = next_ns % NS_PER_S;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+		/* collect finished requests, the others are still running concurrently */
+		while(waitpid(-1, NULL, WNOHANG) > 0);
+
+		latencies[i] = -1;
+		child = fork();
+		if(child == -1)
+		{
+			fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
+		}
+		else if(child == 0)
+		{
+			latencies[i] = replay_request(server, port, (const char *) (record + 1), (size_t) record->length);
+			_exit(latencies[i] == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+	}
+	while(wait(NULL) != -1 || errno == EINTR);
+	free(records);
+
+	if(latency_path != NULL)
+	{
+		latency_file = fopen(latency_path, "w");
+		if(latency_file == NULL)
+		{
+			fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, latency_path, strerror(errno));
+		}
+		else
+		{
+			for(i = 0; i < count; i++)
+			{
+				fprintf(latency_file, "%zu %lld\n", i, latencies[i]);
+			}
+			my_close(latency_file);
+		}
+	}
+
+	replay_statistics(latencies, count, &statistics);
+	fprintf(report_stream(), "requests: %zu, failed: %zu\n", statistics.count, statistics.failed);
+	if(truncated > 0)
+	{
+		fprintf(report_stream(), "truncated: %zu (replayed with the captured bytes only)\n", truncated);
+	}
+	fprintf(report_stream(), "latency mean: %lld us, p50: %lld us, p99: %lld us, max: %lld us\n",
+			statistics.mean_us, statistics.p50_us, statistics.p99_us, statistics.max_us);
+
+	if(baseline_path != NULL)
+	{
+		if(read_latency_file(baseline_path, &baseline_latencies, &baseline_count) == -1)
+		{
+			fprintf(stderr, "%s: cannot read baseline %s - %s\n", prg_name, baseline_path, strerror(errno));
+		}
+		else
+		{
+			replay_statistics(baseline_latencies, baseline_count, &baseline);
+			free(baseline_latencies);
+			fprintf(report_stream(), "baseline requests: %zu, failed: %zu\n", baseline.count, baseline.failed);
+			fprintf(report_stream(), "difference mean: %+lld us, p50: %+lld us, p99: %+lld us, max: %+lld us\n",
+					statistics.mean_us - baseline.mean_us, statistics.p50_us - baseline.p50_us,
+					statistics.p99_us - baseline.p99_us, statistics.max_us - baseline.max_us);
+		}
+	}
+
+	return (statistics.failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/**
+ *
+ * \brief replay_request function sends one captured request and reads the whole response
+ *
+ * \param server passes the FQDN or IP address of the server, or unix:/path
+ * \param port passes the port of the server
+ * \param request passes the captured request bytes
+ * \param length passes the number of bytes
+ *
+ * \return time from connect() until the response was received completely in microseconds
+ * \return -1 on error
+ *
+ */
+long long replay_request(const char *server, const char *port, const char *request, size_t length)
+{
+	char discard[STREAM_CHUNK_SIZE];
+	struct timespec start;
+	struct timespec end;
+	ssize_t bytes_read;
+	int socket_desc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	socket_desc = connect_server(server, port);
+	if(socket_desc == -1)
+	{
+		return -1;
+	}
+	if(sms_write_all(socket_desc, request, length) == -1 || shutdown(socket_desc, SHUT_WR) == -1)
+	{
+		close(socket_desc);
+		return -1;
+	}
+	while((bytes_read = read(socket_desc, discard, sizeof(discard))) > 0);
+	close(socket_desc);
+	if(bytes_read == -1)
+	{
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start.tv_sec) * NS_PER_S + (end.tv_nsec - start.tv_nsec)) / NS_PER_US;
+}
+/**
+ *
+ * \brief run_query function asks the server for the board entries after an ID
+ *
+ * The server answers with board_page.txt, or board_snapshot.bin with --snapshot, which
+ * is received like the response to a post (--dedupe, --stdout and --output-fd apply).
+ * With --merge the snapshot is merged into a local snapshot file afterwards; without
+ * --query the entries after the last entry of that file are asked for.
+ *
+ * \param argc passes the number of arguments left by parse_extra_options()
+ * \param argv passes these arguments
+ *
+ * \return EXIT_SUCCESS if the page was received
+ * \return EXIT_FAILURE on error
+ *
+ */
+int run_query(int argc, const char **argv)
+{
+	struct option long_options[] =
+	{
+		{"server", 1, NULL, 's'},
+		{"port", 1, NULL, 'p'},
+		{"verbose", 0, NULL, 'v'},
+		{0, 0, 0, 0}
+	};
+	char request[MAXIMUM_SIZE];
+	char since[sizeof("18446744073709551615")];
+	const char *server = NULL;
+	const char *port = NULL;
+	uint64_t last_id = 0;
+	off_t end;
+	int request_length;
+	int socket_desc;
+	int merge_fd;
+	int option;
+
+	while((option = getopt_long(argc, (char **) argv, "s:p:v", long_options, NULL)) != -1)
+	{
+		switch(option)
+		{
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(stderr, argv[0], EXIT_FAILURE);
+		}
+	}
+	if(server == NULL || port == NULL)
+	{
+		usage(stderr, argv[0], EXIT_FAILURE);
+	}
+
+	if(merge_path != NULL)
+	{
+		/* the snapshot is merged from the file the response is written to */
+		if(output_fd != -1)
+		{
+			fprintf(stderr, "%s: --merge cannot be used with --stdout or --output-fd\n", prg_name);
+			usage(stderr, argv[0], EXIT_FAILURE);
+		}
+		query_snapshot = 1;
+		if(query_since == NULL)
+		{
+			merge_fd = open(merge_path, O_RDONLY | O_CLOEXEC);
+			if(merge_fd == -1 && errno != ENOENT)
+			{
+				fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, merge_path, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			if(merge_fd != -1 && snapshot_last_id(merge_fd, &last_id, &end) == -1)
+			{
+				fprintf(stderr, "%s: %s is no board snapshot\n", prg_name, merge_path);
+				close(merge_fd);
+				return EXIT_FAILURE;
+			}
+			if(merge_fd != -1)
+			{
+				close(merge_fd);
+			}
+			snprintf(since, sizeof(since), "%llu", (unsigned long long) last_id);
+			query_since = since;
+		}
+	}
+
+	request_length = snprintf(request, sizeof(request), "%ssince=%s%s%s%s\n", SMS_BOARD_QUERY_PREFIX, query_since,
+			(query_limit != NULL) ? "&limit=" : "", (query_limit != NULL) ? query_limit : "",
+			query_snapshot ? "&format=binary" : "");
+	if(request_length < 0 || (size_t) request_length >= sizeof(request))
+	{
+		usage(stderr, argv[0], EXIT_FAILURE);
+	}
+
+	socket_desc = (retries > 0) ? connect_retry(server, port) : connect_server(server, port);
+	if(socket_desc == -1)
+	{
+		return EXIT_FAILURE;
+	}
+	verbose_print(", %s(), line %d] Query %s",  __func__, __LINE__, request);
+	if(sms_write_all(socket_desc, request, (size_t) request_length) == -1 || shutdown(socket_desc, SHUT_WR) == -1)
+	{
+		fprintf(stderr, "%s: failed to send query - %s\n", prg_name, strerror(errno));
+		close(socket_desc);
+		return EXIT_FAILURE;
+	}
+
+	/* closes the socket */
+	if(receive_response(socket_desc) != EXIT_SUCCESS)
+	{
+		return EXIT_FAILURE;
+	}
+
+	if(merge_path != NULL && merge_snapshot(SMS_BOARD_SNAPSHOT_FILE, merge_path) == -1)
+	{
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+/**
+ *
+ * \brief snapshot_last_id function finds the last complete entry of a board snapshot file
+ *
+ * Only the entry headers are read. An empty file is a snapshot without entries.
+ *
+ * \param fd passes the descriptor of the snapshot file
+ * \param last_id returns the ID of the last complete entry, 0 if there is none
+ * \param end returns the end of the last complete entry, 0 for an empty file
+ *
+ * \return 0 when no error occurs
+ * \return -1 if the file is no board snapshot or cannot be read
+ *
+ */
+int snapshot_last_id(int fd, uint64_t *last_id, off_t *end)
+{
+	struct sms_board_entry entry;
+	struct stat file_status;
+	char magic[SMS_BOARD_MAGIC_LENGTH];
+	uint64_t offset;
+	uint64_t length;
+
+	*last_id = 0;
+	*end = 0;
+	if(fstat(fd, &file_status) == -1)
+	{
+		return -1;
+	}
+	if(file_status.st_size == 0)
+	{
+		return 0;
+	}
+	if(pread(fd, magic, sizeof(magic), 0) != (ssize_t) sizeof(magic) || memcmp(magic, SMS_BOARD_MAGIC, sizeof(magic)) != 0)
+	{
+		return -1;
+	}
+
+	/* an entry cut off by an interrupted merge is not counted */
+	for(offset = SMS_BOARD_MAGIC_LENGTH; pread(fd, &entry, sizeof(entry), (off_t) offset) == (ssize_t) sizeof(entry);
+			offset += length)
+	{
+		if(entry.message_length > (uint64_t) file_status.st_size)
+		{
+			break;
+		}
+		length = SMS_BOARD_PADDED(sizeof(entry) + entry.user_length + entry.image_length + entry.message_length);
+		if(offset + length > (uint64_t) file_status.st_size)
+		{
+			break;
+		}
+		*last_id = entry.id;
+	}
+	*end = (off_t) offset;
+
+	return 0;
+}
+/**
+ *
+ * \brief merge_snapshot function appends the entries of a received snapshot to a local snapshot file
+ *
+ * Entries the local file already has (IDs up to its last ID) are skipped, so a page can
+ * be merged more than once. The entries have to continue the local file without a gap:
+ * pages are merged in order, a page that starts after the next ID is rejected with the
+ * entries the file is missing. Only an empty file may start at any ID. The local file is
+ * locked while it is merged.
+ *
+ * \param snapshot_path passes the received snapshot
+ * \param merge_path passes the local snapshot file, created if it does not exist
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int merge_snapshot(const char *snapshot_path, const char *merge_path)
+{
+	const struct sms_board_entry *entry;
+	struct stat file_status;
+	const char *snapshot;
+	uint64_t last_id;
+	uint64_t offset;
+	uint64_t length;
+	size_t merged = 0;
+	off_t end;
+	int snapshot_fd;
+	int merge_fd;
+	int check = 0;
+
+	snapshot_fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+	if(snapshot_fd == -1 || fstat(snapshot_fd, &file_status) == -1)
+	{
+		fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, snapshot_path, strerror(errno));
+		return -1;
+	}
+	if(file_status.st_size < SMS_BOARD_MAGIC_LENGTH)
+	{
+		fprintf(stderr, "%s: %s is no board snapshot\n", prg_name, snapshot_path);
+		close(snapshot_fd);
+		return -1;
+	}
+	snapshot = mmap(NULL, (size_t) file_status.st_size, PROT_READ, MAP_PRIVATE, snapshot_fd, 0);
+	close(snapshot_fd);
+	if(snapshot == MAP_FAILED || memcmp(snapshot, SMS_BOARD_MAGIC, SMS_BOARD_MAGIC_LENGTH) != 0)
+	{
+		fprintf(stderr, "%s: %s is no board snapshot\n", prg_name, snapshot_path);
+		if(snapshot != MAP_FAILED)
+		{
+			munmap((void *) snapshot, (size_t) file_status.st_size);
+		}
+		return -1;
+	}
+
+	merge_fd = open(merge_path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(merge_fd == -1 || flock(merge_fd, LOCK_EX) == -1)
+	{
+		fprintf(stderr, "%s: cannot open %s - %s\n", prg_name, merge_path, strerror(errno));
+		munmap((void *) snapshot, (size_t) file_status.st_size);
+		if(merge_fd != -1)
+		{
+			close(merge_fd);
+		}
+		return -1;
+	}
+	if(snapshot_last_id(merge_fd, &last_id, &end) == -1)
+	{
+		fprintf(stderr, "%s: %s is no board snapshot\n", prg_name, merge_path);
+		check = -1;
+	}
+	/* a new file gets the magic, an entry cut off by an interrupted merge is dropped */
+	else if(ftruncate(merge_fd, end) == -1 || lseek(merge_fd, end, SEEK_SET) == -1
+			|| (end == 0 && sms_write_all(merge_fd, SMS_BOARD_MAGIC, SMS_BOARD_MAGIC_LENGTH) == -1))
+	{
+		fprintf(stderr, "%s: cannot write %s - %s\n", prg_name, merge_path, strerror(errno));
+		check = -1;
+	}
 
+	for(offset = SMS_BOARD_MAGIC_LENGTH; check == 0 && offset + sizeof(*entry) <= (uint64_t) file_status.st_size;
+			offset += length)
+	{
+		entry = (const struct sms_board_entry *) (snapshot + offset);
+		if(entry->message_length > (uint64_t) file_status.st_size)
+		{
 			break;
-			/* if looked for values were not found with check_stream */
-		case 4:
-			my_close(client_socket);
-			my_close(write_to);
-			return EXIT_SUCCESS;
+		}
+		length = SMS_BOARD_PADDED(sizeof(*entry) + entry->user_length + entry->image_length + entry->message_length);
+		if(offset + length > (uint64_t) file_status.st_size)
+		{
 			break;
-		default:
-			if(write_to == NULL)
-			{
-				fprintf(stderr, "Something went wrong - no file was opened - %s\n",  strerror(errno));
-				verbose_print(", %s(), line %d] No file was opened\n",  __func__, __LINE__);
-				my_close(client_socket);
-				return EXIT_FAILURE;
-			}
 		}
-
-		if(mode == 3)
+		if(entry->id <= last_id)
 		{
-			bytes_read = 0;
-			bytes_received=0;
+			continue;
+		}
+		if(entry->id != last_id + 1 && last_id != 0)
+		{
+			fprintf(stderr, "%s: %s ends at entry %llu, %s continues at %llu - merge the entries in between first\n",
+					prg_name, merge_path, (unsigned long long) last_id, snapshot_path, (unsigned long long) entry->id);
+			check = -1;
+			break;
+		}
+		if(sms_write_all(merge_fd, snapshot + offset, (size_t) length) == -1)
+		{
+			fprintf(stderr, "%s: cannot write %s - %s\n", prg_name, merge_path, strerror(errno));
+			check = -1;
+			break;
+		}
+		last_id = entry->id;
+		merged++;
+	}
+	if(check == 0)
+	{
+		fprintf(report_stream(), "merged %zu entries into %s, last id %llu\n", merged, merge_path,
+				(unsigned long long) last_id);
+	}
 
-			while(1)
-			{
-				/* only for logging */
-				count++;
+	munmap((void *) snapshot, (size_t) file_status.st_size);
+	/* closing releases the lock */
+	close(merge_fd);
 
-				if(MAXIMUM_SIZE < (file_length_received))
-				{
-					maximum_buffer = MAXIMUM_SIZE;
-				}
-				else
-				{
-					maximum_buffer = file_length_received;
-				}
-				verbose_print(", %s(), line %d] Read part: %d byte %d\n",  __func__, __LINE__, count, maximum_buffer);
+	return check;
+}
+/**
+ *
+ * \brief replay_statistics function summarizes the latencies of a replay
+ *
+ * \param latencies passes the latencies in microseconds (-1 for failed requests)
+ * \param count passes the number of latencies
+ * \param statistics returns the summary
+ *
+ */
+void replay_statistics(const long long *latencies, size_t count, struct replay_statistics *statistics)
+{
+	long long *sorted;
+	long long sum = 0;
+	size_t successful = 0;
+	size_t i;
 
-				/* read data from the socket */
-				bytes_read = fread(receive_buffer, sizeof(char), maximum_buffer, client_socket);
-				verbose_print(", %s(), line %d] Bytes_read called",  __func__, __LINE__);
-				bytes_received = bytes_received + maximum_buffer;
+	memset(statistics, 0, sizeof(*statistics));
+	statistics->count = count;
 
-				/* write to file */
-				check_write = (int)fwrite(receive_buffer, sizeof(char), bytes_read, write_to);
-				/* if not as many bytes were read as written, an error occurs */
-				if (check_write != bytes_read)
-				{
-					my_close(client_socket);
-					my_close(write_to);
-					fprintf(stderr, "Error writing to file");
-					return EXIT_FAILURE;
-				}
-				/* error handling for fwrite */
-				if(check_write < bytes_read)
-				{
-					my_close(client_socket);
-					my_close(write_to);
-					fprintf(stderr, "Error in fwrite");
-					return EXIT_FAILURE;
-				}
+	sorted = malloc((count + 1) * sizeof(*sorted));
+	if(sorted == NULL)
+	{
+		return;
+	}
+	for(i = 0; i < count; i++)
+	{
+		if(latencies[i] < 0)
+		{
+			statistics->failed++;
+			continue;
+		}
+		sorted[successful++] = latencies[i];
+		sum += latencies[i];
+	}
 
+	if(successful > 0)
+	{
+		qsort(sorted, successful, sizeof(*sorted), compare_latency);
+		statistics->mean_us = sum / (long long) successful;
+		statistics->p50_us = sorted[(successful - 1) / 2];
+		statistics->p99_us = sorted[((successful - 1) * 99) / 100];
+		statistics->max_us = sorted[successful - 1];
+	}
+	free(sorted);
+}
+/**
+ *
+ * \brief compare_latency function compares two latencies for qsort()
+ *
+ * \param left passes the first latency
+ * \param right passes the second latency
+ *
+ * \return <0, 0 or >0 like strcmp()
+ *
+ */
+int compare_latency(const void *left, const void *right)
+{
+	long long a = *(const long long *) left;
+	long long b = *(const long long *) right;
 
-				/* if the received bytes are the same as the file length, check if there is 
-				* another record and close file to write to*/
-				if(bytes_received >= file_length_received)
-				{
-					my_close(write_to);
-					/* Next record */
-					mode = 1;
-					break;
-				}
+	return (a > b) - (a < b);
+}
+/**
+ *
+ * \brief compare_arrival function compares the arrival times of two capture records for qsort()
+ *
+ * Records arriving at the same time keep their order in the capture file.
+ *
+ * \param left passes a pointer to the first record
+ * \param right passes a pointer to the second record
+ *
+ * \return <0, 0 or >0 like strcmp()
+ *
+ */
+int compare_arrival(const void *left, const void *right)
+{
+	const struct sms_capture_record *a = *(const struct sms_capture_record * const *) left;
+	const struct sms_capture_record *b = *(const struct sms_capture_record * const *) right;
 
-				/* if there was a reading error, break */
-				if(ferror(client_socket) != 0)
-				{
-					my_close(write_to);
-					my_close(client_socket);
-					fprintf(stderr, "Error reading from stream");
-					return EXIT_FAILURE;
-				}
+	if(a->arrival_ns != b->arrival_ns)
+	{
+		return (a->arrival_ns > b->arrival_ns) - (a->arrival_ns < b->arrival_ns);
+	}
+	return (a > b) - (a < b);
+}
+/**
+ *
+ * \brief read_latency_file function reads a latency file written by --latency-file
+ *
+ * \param path passes the latency file
+ * \param latencies returns the latencies (to be freed by the caller)
+ * \param count returns the number of latencies
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int read_latency_file(const char *path, long long **latencies, size_t *count)
+{
+	FILE *latency_file;
+	long long *grown;
+	long long latency;
+	size_t index;
+	size_t size = 0;
+
+	latency_file = fopen(path, "r");
+	if(latency_file == NULL)
+	{
+		return -1;
+	}
+
+	*latencies = NULL;
+	*count = 0;
+	while(fscanf(latency_file, "%zu %lld", &index, &latency) == 2)
+	{
+		if(*count == size)
+		{
+			size = (size == 0) ? 1024 : size * 2;
+			grown = realloc(*latencies, size * sizeof(**latencies));
+			if(grown == NULL)
+			{
+				free(*latencies);
+				fclose(latency_file);
+				return -1;
 			}
+			*latencies = grown;
 		}
+		(*latencies)[(*count)++] = latency;
 	}
-	my_close(client_socket);
-	verbose_print(", %s(), line %d] EOF reached \n",  __func__, __LINE__);
-
-
-	return EXIT_SUCCESS;
 
+	fclose(latency_file);
+	return 0;
 }
 /**
  * \brief check_stream Function checks for values and returns that if found
@@ -460,6 +2887,7 @@ int receive_response(int socket_desc)
 int check_stream(char *stream, const char *lookup, char *value)
 {
 	char *position;
+	size_t length;
 
 	verbose_print(", %s(), line %d] Bin in Check stream\n",  __func__, __LINE__);
 
@@ -478,7 +2906,16 @@ int check_stream(char *stream, const char *lookup, char *value)
 		memset(value, 0, MAXIMUM_SIZE);
 		/* copy position into value, but only the length of position minus the terminating byte
 		 * - for value to be passed to calling receive_response function*/
-		strncpy(value, position, (strlen(position) - 1));
+		length = strlen(position);
+		if(length > 0)
+		{
+			length--;
+		}
+		if(length > MAXIMUM_SIZE - 1)
+		{
+			length = MAXIMUM_SIZE - 1;
+		}
+		memcpy(value, position, length);
 
 		verbose_print(", %s(), line %d]: check for %s, Value %s\n",  __func__, __LINE__,  lookup, value);
 		return 0;
@@ -507,7 +2944,27 @@ static void usage(FILE *out, const char *prog_name, int exit_status)
 	    fprintf(out,"\t-p, --port <port>       well-known port of the server [0..65535]\n");
 	    fprintf(out,"\t-u, --user <name>       name of the posting user\n");
 	    fprintf(out,"\t-i, --image <URL>       URL pointing to an image of the posting user\n");
-	    fprintf(out,"\t-m, --message <message> message to be added to the bulletin board\n");
+	    fprintf(out,"\t    --image-file <file> upload a local image of the posting user (instead of -i)\n");
+	    fprintf(out,"\t-m, --message <message> message to be added to the bulletin board (- reads it from stdin)\n");
+	    fprintf(out,"\t    --message-file <file> stream the message from file\n");
+	    fprintf(out,"\t    --dedupe            do not rewrite unchanged response files, report unchanged/updated/new\n");
+	    fprintf(out,"\t    --agent <unix:/path> run as agent keeping connections to servers warm,\n");
+	    fprintf(out,"\t                        used by clients started with %s=<unix:/path>\n", AGENT_ENVIRONMENT);
+	    fprintf(out,"\t                        (each warm connection keeps a server process waiting)\n");
+	    fprintf(out,"\t    --compress          ask the server for deflate compressed response files\n");
+	    fprintf(out,"\t    --query <id>        get the board entries after entry id (server started with --board)\n");
+	    fprintf(out,"\t    --limit <n>         number of entries returned by --query (default 50)\n");
+	    fprintf(out,"\t    --snapshot          get the entries as binary snapshot instead of text\n");
+	    fprintf(out,"\t    --merge <file>      merge the snapshot into file (without --query: the entries after\n");
+	    fprintf(out,"\t                        the last one in file)\n");
+	    fprintf(out,"\t    --retries <n>       retry a refused connect n times with exponential backoff (default 0)\n");
+	    fprintf(out,"\t    --retry-budget <ms> maximum time spent in backoff (default %d)\n", RETRY_BUDGET_MS);
+	    fprintf(out,"\t    --stdout            write the response as file=/len= records to stdout instead of files\n");
+	    fprintf(out,"\t    --output-fd <fd>    write the response as file=/len= records to descriptor fd\n");
+	    fprintf(out,"\t    --replay <file>     replay a capture of simple_message_server --capture against -s/-p\n");
+	    fprintf(out,"\t    --speed <factor>    replay speed (default 1.0, 2 replays twice as fast)\n");
+	    fprintf(out,"\t    --latency-file <file> write the latency of each replayed request to file\n");
+	    fprintf(out,"\t    --baseline <file>   compare the replay with the latency file of a previous run\n");
 	    fprintf(out,"\t-v, --verbose           verbose output (for debugging purpose)\n");
 	    fprintf(out,"\t-h, --help\n");
 
@@ -525,7 +2982,21 @@ static void usage(FILE *out, const char *prog_name, int exit_status)
 
 /**
  *
- * \brief verbose_print Function prints to stdout if -v is activated
+ * \brief report_stream function returns the stream for verbose output and reports
+ *
+ * This is stdout, unless the response records are streamed to stdout (--stdout or
+ * --output-fd 1); then everything else goes to stderr and stdout carries only records.
+ *
+ * \return stdout or stderr
+ *
+ */
+FILE *report_stream(void)
+{
+	return (output_fd == STDOUT_FILENO) ? stderr : stdout;
+}
+/**
+ *
+ * \brief verbose_print Function prints to report_stream() if -v is activated
  *
  * \return EXIT_SUCCESS if no error occurs
  * \return EXIT_FAILURE if an error occurs
@@ -538,9 +3009,9 @@ void verbose_print(const char *format, ...)
 
 	if(verbose != 0)
 	{
-		fprintf(stdout, "%s [%s",prg_name, __FILE__);
+		fprintf(report_stream(), "%s [%s",prg_name, __FILE__);
 		va_start(argp, format);
-		n = vfprintf(stdout, format, argp);
+		n = vfprintf(report_stream(), format, argp);
 
 		if(n < 0)
 		{
@@ -579,5 +3050,180 @@ void my_close(FILE *fp)
 		fprintf(stderr, "Underlying file descriptor is bad.");
 	}
 }
+/**
+ *
+ * \brief parse_extra_options function takes the options smc_parsecommandline() does not know out of argv
+ *
+ * \param argc passes the number of arguments
+ * \param argv passes the arguments
+ * \param smc_argv returns the remaining arguments for smc_parsecommandline() (argc + 3 entries)
+ *
+ * \return number of arguments in smc_argv
+ *
+ */
+int parse_extra_options(int argc, const char * const argv[], const char **smc_argv)
+{
+	int i;
+	int smc_argc = 0;
+	const char *value;
+	char *end_ptr;
+
+	for(i = 0; i < argc; i++)
+	{
+		if(i > 0 && match_option("--message-file", argc, argv, &i, &message_file) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--image-file", argc, argv, &i, &image_file) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--dedupe", argc, argv, &i, NULL) == 1)
+		{
+			dedupe = 1;
+			continue;
+		}
+		if(i > 0 && match_option("--agent", argc, argv, &i, &agent_endpoint) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--replay", argc, argv, &i, &replay_path) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--speed", argc, argv, &i, &value) == 1)
+		{
+			replay_speed = strtod(value, &end_ptr);
+			if(*value == '\0' || *end_ptr != '\0' || replay_speed <= 0)
+			{
+				usage(stderr, argv[0], EXIT_FAILURE);
+			}
+			continue;
+		}
+		if(i > 0 && match_option("--latency-file", argc, argv, &i, &latency_path) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--baseline", argc, argv, &i, &baseline_path) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--compress", argc, argv, &i, NULL) == 1)
+		{
+			compress_response = 1;
+			continue;
+		}
+		if(i > 0 && match_option("--query", argc, argv, &i, &query_since) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--limit", argc, argv, &i, &query_limit) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--snapshot", argc, argv, &i, NULL) == 1)
+		{
+			query_snapshot = 1;
+			continue;
+		}
+		if(i > 0 && match_option("--merge", argc, argv, &i, &merge_path) == 1)
+		{
+			continue;
+		}
+		if(i > 0 && match_option("--retries", argc, argv, &i, &value) == 1)
+		{
+			retries = (int) strtol(value, &end_ptr, 10);
+			if(*value == '\0' || *end_ptr != '\0' || retries < 0)
+			{
+				usage(stderr, argv[0], EXIT_FAILURE);
+			}
+			continue;
+		}
+		if(i > 0 && match_option("--retry-budget", argc, argv, &i, &value) == 1)
+		{
+			retry_budget_ms = strtol(value, &end_ptr, 10);
+			if(*value == '\0' || *end_ptr != '\0' || retry_budget_ms < 0)
+			{
+				usage(stderr, argv[0], EXIT_FAILURE);
+			}
+			continue;
+		}
+		if(i > 0 && match_option("--stdout", argc, argv, &i, NULL) == 1)
+		{
+			output_fd = STDOUT_FILENO;
+			continue;
+		}
+		if(i > 0 && match_option("--output-fd", argc, argv, &i, &value) == 1)
+		{
+			output_fd = (int) strtol(value, &end_ptr, 10);
+			if(*value == '\0' || *end_ptr != '\0' || output_fd < 0)
+			{
+				usage(stderr, argv[0], EXIT_FAILURE);
+			}
+			continue;
+		}
+		smc_argv[smc_argc++] = argv[i];
+	}
+
+	/* the message is mandatory for smc_parsecommandline() - the file replaces it */
+	if(message_file != NULL)
+	{
+		smc_argv[smc_argc++] = "-m";
+		smc_argv[smc_argc++] = STREAM_MESSAGE;
+	}
+	smc_argv[smc_argc] = NULL;
+
+	return smc_argc;
+}
+/**
+ *
+ * \brief match_option function checks if argv[*index] is the long option name
+ *
+ * Accepts "--name value" and "--name=value". For options without a value pass NULL
+ * as value.
+ *
+ * \param name passes the long option including the leading "--"
+ * \param argc passes the number of arguments
+ * \param argv passes the arguments
+ * \param index passes the current index, is advanced if the value is the next argument
+ * \param value returns the value of the option
+ *
+ * \return 1 if the option matched
+ * \return 0 if not
+ *
+ */
+int match_option(const char *name, int argc, const char * const argv[], int *index, const char **value)
+{
+	size_t name_length = strlen(name);
+
+	if(strncmp(argv[*index], name, name_length) != 0)
+	{
+		return 0;
+	}
+
+	if(value == NULL)
+	{
+		return argv[*index][name_length] == '\0';
+	}
+
+	if(argv[*index][name_length] == '=')
+	{
+		*value = argv[*index] + name_length + 1;
+		return 1;
+	}
+
+	if(argv[*index][name_length] != '\0')
+	{
+		return 0;
+	}
 
+	/* value is missing */
+	if(*index + 1 >= argc)
+	{
+		usage(stderr, argv[0], EXIT_FAILURE);
+	}
+	*index = *index + 1;
+	*value = argv[*index];
 
+	return 1;
+}
@@ -15,11 +15,14 @@
  * ----------------------------- includes -------------------------
  */
 
+/* splice() */
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
 #include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,9 +31,25 @@
 #include <sys/socket.h>
 #include <limits.h>
 #include "simple_message_client_commandline_handling.h"
+#include "simple_message_socket.h"
+#include "simple_message_capture.h"
+#include "simple_message_board.h"
 #include <sys/wait.h>
 #include <signal.h>
 #include <getopt.h>
+#include <ctype.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <zlib.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 
 
 /*
@@ -38,185 +57,2678 @@
  */
 /* Backlog */
 #define LISTEN 24
-/* path to servers business logic */
+/* path to servers business logic, make bench builds the server with a stand-in */
+#ifndef PATHSERVERLOGIC
 #define PATHSERVERLOGIC "/usr/local/bin/simple_message_server_logic"
+#endif
 #define PORT_MIN 0
 #define PORT_MAX 65535
 #define STRTOL_BASE 10
+/* bytes of the request peeked at by the parent before forking */
+#define PEEK_SIZE 256
+/* mandatory first line of every request */
+#define USER_PREFIX "user="
+/* response sent by the parent for requests rejected before forking */
+#define INVALID_REQUEST_RESPONSE "status=1\n"
+/* seconds the kernel holds back a connection until the first request bytes arrived */
+#define DEFER_ACCEPT_SECONDS 5
+/* milliseconds validate_request() waits for the first request bytes, the accept loop
+ * stands still meanwhile */
+#define VALIDATE_WAIT_MS 10
+/* buffer for the request header read by the server (user=, imgfile= and len= lines) */
+#define HEADER_SIZE 4096
+/* chunk size for copying uploads and relaying the request */
+#define CHUNK_SIZE 65536
+/* header line of an image uploaded by the client */
+#define IMGFILE_PREFIX "imgfile="
+#define LEN_PREFIX "len="
+#define STATUS_PREFIX "status="
+/* largest image accepted if no --image-max is given */
+#define IMAGE_MAX_DEFAULT 1048576
+/* bytes of a request kept for the capture file and the board index by default */
+#define CAPTURE_MAX_DEFAULT 1048576
+/* go-ahead for the client to send the image bytes of an upload */
+#define CONTINUE_LINE "continue\n"
+/* longest file extension kept for stored images (including the dot) */
+#define EXTENSION_MAX 8
+/* different images with the same hash and length stored before an upload is refused */
+#define IMAGE_COLLISIONS_MAX 16
+/* request line of clients accepting compressed files and the matching record line */
+#define ACCEPT_ENCODING_PREFIX "accept-encoding="
+#define ACCEPT_ENCODING "accept-encoding=deflate"
+#define ENCODING_LINE "encoding=deflate\n"
+/* files smaller than this are sent uncompressed */
+#define COMPRESS_MIN 1024
+/* size the compression cache is trimmed to by default (--compress-cache-max) */
+#define COMPRESS_CACHE_MAX_DEFAULT 67108864
+#define COMPRESS_CACHE_SUFFIX ".deflate"
+/* worker placement (--cpu-policy) */
+#define CPU_POLICY_NONE 0
+#define CPU_POLICY_ROUNDROBIN 1
+#define CPU_POLICY_INCOMING 2
+/* entries returned by a query request at most, and if no limit is given */
+#define BOARD_LIMIT_MAX 1000
+#define BOARD_LIMIT_DEFAULT 50
+/* sysfs directory listing the NUMA node of each CPU */
+#define SYSFS_CPU "/sys/devices/system/cpu"
+/* set_mempolicy() mode, <numaif.h> is part of libnuma and not needed otherwise */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/*
+ * -------------------------------------------------------------- typedefs --
+ */
+
+/* start of a request read by the server itself, the rest is relayed to the business logic */
+struct request_header
+{
+	int socket_desc;
+	char buffer[HEADER_SIZE];
+	/* number of bytes in buffer */
+	size_t length;
+	/* first byte not consumed yet */
+	size_t position;
+};
+
+/* request bytes collected by the relay for the capture file */
+struct capture_buffer
+{
+	char *data;
+	size_t length;
+	size_t size;
+};
+
+/* file of the compression cache, ordered by trim_compress_cache() */
+struct cache_entry
+{
+	char name[NAME_MAX + 1];
+	long long mtime;
+	off_t size;
+};
 
 /*
  * ---------------------------------- globals ------------------------
  */
-const char *prg_name;
+const char *prg_name;
+/* unix socket path used to hand the listening socket over to a new server */
+static const char *handoff_path = NULL;
+/* directory uploaded images are stored in by content hash, NULL if uploads are not accepted */
+static const char *image_store = NULL;
+/* prefix of the img= URL passed to the business logic for stored images */
+static const char *image_url = NULL;
+/* largest image upload accepted in bytes */
+static long image_max = IMAGE_MAX_DEFAULT;
+/* file requests are recorded in for replay (--capture) */
+static const char *capture_path = NULL;
+static int capture_fd = -1;
+/* bytes of a request kept in memory for the capture file and the board index */
+static long capture_max = CAPTURE_MAX_DEFAULT;
+/* compress response files for clients sending ACCEPT_ENCODING (--compress) */
+static int compress_responses = 0;
+/* directory compressed copies of response files are kept in (--compress-cache), NULL if none */
+static const char *compress_cache = NULL;
+static long long compress_cache_max = COMPRESS_CACHE_MAX_DEFAULT;
+/* directory the board index is kept in (--board), NULL if queries are not answered */
+static const char *board_dir = NULL;
+/* placement of the workers (--cpu-policy) on the CPUs the server may use, NUMA node of each CPU */
+static int cpu_policy = CPU_POLICY_NONE;
+static cpu_set_t allowed_cpus;
+static int cpu_node[CPU_SETSIZE];
+static int numa_nodes = 1;
+static int next_cpu = 0;
+/* file the placement of each worker is reported to (--placement-report) */
+static const char *placement_path = NULL;
+static int placement_fd = -1;
+
+/*
+ * ---------------------------------- function prototypes ------------
+ */
+
+void my_usage(FILE * out, int exit_status);
+void check_parameters_server(int argc, char *argv[], const char **port);
+void signal_child(int sig);
+int create_listen_socket(const char *port);
+int create_unix_listen_socket(const struct sockaddr_un *unix_address, socklen_t unix_address_length);
+int receive_listen_socket(const char *path);
+int create_handoff_socket(const char *path);
+int hand_over_listen_socket(int handoff_desc, int socket_desc);
+void drain_children(void);
+int validate_request(int socket_desc);
+int has_header_extension(int socket_desc);
+int prepare_request(int socket_desc, uint64_t arrival_ns, int *deflate_response, int *post_desc);
+int start_response_relay(int socket_desc, int deflate_response, int post_desc);
+void run_response_relay(int logic_desc, int socket_desc, int deflate_response, int post_desc);
+int compress_payload(FILE *logic, size_t length, int *compressed_fd, off_t *compressed_length);
+int deflate_payload(FILE *in, size_t length, int compressed_fd);
+int cached_payload_matches(int compressed_fd, FILE *raw, size_t length);
+int compare_cache_entries(const void *left, const void *right);
+void trim_compress_cache(void);
+char *next_header_line(struct request_header *header, size_t *line_length);
+int store_image(struct request_header *header, const char *name, long length, char *url, size_t url_size);
+int same_content(const char *path, const char *other_path);
+int relay_request(int socket_desc, const char *header, size_t header_length, const char *rest, size_t rest_length,
+		uint64_t arrival_ns, int *post_desc);
+int open_capture(const char *path);
+int capture_append(struct capture_buffer *capture, const char *data, size_t length);
+int capture_limited(struct capture_buffer *capture, const char *data, size_t length, uint64_t *original_length);
+int write_capture_record(uint64_t arrival_ns, const char *data, size_t length, uint64_t original_length);
+int is_query(int socket_desc);
+int answer_query(int socket_desc);
+int send_board_page(int socket_desc, int log_fd, uint64_t offset, uint64_t length);
+int board_append(uint64_t posted_ns, const char *request, size_t length);
+int board_append_post(int post_desc);
+int init_placement(void);
+int choose_cpu(int socket_desc, int *incoming_cpu);
+void place_worker(int cpu, int incoming_cpu);
+
+
+/**
+ *
+ * \brief Main function implements a server which connects to a client
+ * Main entry point
+ *
+ * \param argc passes the number of arguments
+ * \param argv passes the arguments (programme name is argv[0]
+ *
+ * \return EXIT_SUCCESS when no error occurred
+ * \return EXIT_FAILURE when an error occurred
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+
+	int socket_desc, new_socket_desc;
+	int request_desc;
+	int response_desc;
+	int deflate_response = 0;
+	int post_desc = -1;
+	uint64_t arrival_ns = 0;
+	struct timespec now;
+	int handoff_desc = -1;
+	int child;
+	int cpu = -1;
+	int incoming_cpu = -1;
+	int check;
+	struct sockaddr_storage address;
+	socklen_t address_length;
+	struct pollfd poll_desc[2];
+	nfds_t poll_count;
+	/* server port number */
+	const char *port = NULL;
+
+	prg_name = argv[0];
+	check_parameters_server(argc, argv, &port);
+
+	socket_desc = -1;
+	/* on a hot restart the listening socket is taken over from the running server */
+	if(handoff_path != NULL)
+	{
+		socket_desc = receive_listen_socket(handoff_path);
+	}
+
+	if(socket_desc == -1)
+	{
+		socket_desc = create_listen_socket(port);
+		if(socket_desc == -1)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(capture_path != NULL)
+	{
+		capture_fd = open_capture(capture_path);
+		if(capture_fd == -1)
+		{
+			close(socket_desc);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if((cpu_policy != CPU_POLICY_NONE || placement_path != NULL) && init_placement() == -1)
+	{
+		close(socket_desc);
+		return EXIT_FAILURE;
+	}
+
+	/* offer the listening socket to the next server started with the same handoff path */
+	if(handoff_path != NULL)
+	{
+		handoff_desc = create_handoff_socket(handoff_path);
+		if(handoff_desc == -1)
+		{
+			close(socket_desc);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* parent is not informed when child terminates and zombie state is not possible */
+	signal(SIGCHLD, signal_child);
+
+	poll_desc[0].fd = socket_desc;
+	poll_desc[0].events = POLLIN;
+	poll_desc[1].fd = handoff_desc;
+	poll_desc[1].events = POLLIN;
+	poll_count = (handoff_desc == -1) ? 1 : 2;
+
+	/* loop until accept was successful */
+	for(;;)
+	{
+		if(poll(poll_desc, poll_count, -1) == -1)
+		{
+			/* SIGCHLD interrupts poll, just wait again */
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			fprintf(stderr, "%s: error poll %s\n", prg_name, strerror(errno));
+			close(socket_desc);
+			return EXIT_FAILURE;
+		}
+
+		/* a new server wants to take over - hand over the socket, stop accepting and wait for the children */
+		if(poll_count == 2 && poll_desc[1].revents != 0)
+		{
+			if(hand_over_listen_socket(handoff_desc, socket_desc) == 0)
+			{
+				close(socket_desc);
+				drain_children();
+				return EXIT_SUCCESS;
+			}
+			continue;
+		}
+
+		if(poll_desc[0].revents == 0)
+		{
+			continue;
+		}
+
+		address_length = sizeof(address);
+		new_socket_desc = accept(socket_desc, (struct sockaddr *) &address, &address_length);
+		if((capture_fd != -1 || board_dir != NULL) && clock_gettime(CLOCK_REALTIME, &now) == 0)
+		{
+			arrival_ns = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+		}
+
+		/* error handling for accept */
+		if(new_socket_desc == -1)
+		{
+			/* if the system call was interrupted by a signal that was caught before a valid connection was
+			 * established, continue */
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			else
+			{
+				fprintf(stderr, "%s: error accept %s\n", prg_name, strerror(errno));
+				close(socket_desc);
+				return EXIT_FAILURE;
+			}
+		}
+
+		/* reject malformed requests before paying for a process */
+		if(validate_request(new_socket_desc) == -1)
+		{
+			close(new_socket_desc);
+			continue;
+		}
+
+		if(cpu_policy != CPU_POLICY_NONE || placement_fd != -1)
+		{
+			cpu = choose_cpu(new_socket_desc, &incoming_cpu);
+		}
+
+		/* fork child process for execution of business logic */
+		child = fork();
+
+		/* if fork failed -1 is returned */
+		if(child == -1)
+		{
+			close(new_socket_desc);
+			close(socket_desc);
+			fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		else if(child == 0)
+		{
+			close(socket_desc);
+			if(handoff_desc != -1)
+			{
+				close(handoff_desc);
+			}
+			/* before the relays are forked, they run next to the business logic */
+			if(cpu_policy != CPU_POLICY_NONE || placement_fd != -1)
+			{
+				place_worker(cpu, incoming_cpu);
+			}
+			/* queries are answered from the board index without the business logic */
+			if(board_dir != NULL && is_query(new_socket_desc) == 1)
+			{
+				check = answer_query(new_socket_desc);
+				close(new_socket_desc);
+				return (check == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+			}
+			/* the business logic reads the request directly from the socket, unless the server has
+			 * to process the header (image uploads, compression) or record it (capture, board).
+			 * Header lines for the server are never passed on, even if the feature is off. */
+			request_desc = new_socket_desc;
+			response_desc = new_socket_desc;
+			if(image_store != NULL || capture_fd != -1 || board_dir != NULL
+					|| has_header_extension(new_socket_desc) == 1)
+			{
+				request_desc = prepare_request(new_socket_desc, arrival_ns, &deflate_response, &post_desc);
+				if(request_desc == -1)
+				{
+					close(new_socket_desc);
+					return EXIT_FAILURE;
+				}
+			}
+			/* the response passes through the response relay if the client accepts compressed files,
+			 * or if the post is added to the board index once the business logic accepted it */
+			if(deflate_response == 1 || post_desc != -1)
+			{
+				response_desc = start_response_relay(new_socket_desc, deflate_response, post_desc);
+				if(response_desc == -1)
+				{
+					close(new_socket_desc);
+					return EXIT_FAILURE;
+				}
+			}
+			/* to replace stdin with the new socket descriptor */
+			if(dup2(request_desc, 0) == -1)
+			{
+				close(new_socket_desc);
+				return EXIT_FAILURE;
+			}
+			/* to replace stdout with the new socket descriptor */
+			if(dup2(response_desc, 1) == -1)
+			{
+				close(new_socket_desc);
+				return EXIT_FAILURE;
+			}
+			/* execute simple message server logic and terminate call of arguments with NULL */
+			if(execlp(PATHSERVERLOGIC, "simple_message_server_logic", NULL) == -1)
+			{
+				fprintf(stderr, "%s: execlp() failed: %s\n", prg_name, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			close(new_socket_desc);
+		}
+		close(new_socket_desc);
+	}
+
+	return EXIT_SUCCESS;
+
+}
+/**
+ *
+ * \brief create_listen_socket function binds a TCP socket to the given port and starts listening
+ *
+ *
+ * \param port passes the port for the server, or unix:/path for a unix domain socket
+ *
+ * \return listening socket descriptor
+ * \return -1 on error
+ *
+ */
+int create_listen_socket(const char *port)
+{
+	struct addrinfo hints;
+	struct addrinfo *server, *rp;
+	struct sockaddr_un unix_address;
+	socklen_t unix_address_length;
+	int socket_desc = -1;
+	int check;
+	int y = 0;
+
+	/* local clients connect via unix:/path and skip the TCP/IP stack */
+	check = sms_unix_address(port, &unix_address, &unix_address_length);
+	if(check == -1)
+	{
+		fprintf(stderr, "%s: invalid unix socket path %s\n", prg_name, port);
+		return -1;
+	}
+	if(check == 1)
+	{
+		return create_unix_listen_socket(&unix_address, unix_address_length);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	/* server connects to IPv4 address only */
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	y = 1;
+
+	/* retrieves information of addresses that the server may connect to */
+	check = getaddrinfo(NULL, port, &hints, &server);
+	if(check != 0)
+	{
+		/* if gettaddrinfo fails, the according error code is printed with gai_strerror */
+		fprintf(stderr, "%s: error getaddrinfo: %s\n", prg_name, gai_strerror(check));
+		return -1;
+	}
+
+	for (rp = server; rp != NULL; rp = rp->ai_next)
+	{
+		/* retrieve socket descriptor for connection */
+		socket_desc = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if(socket_desc == -1)
+		{
+			fprintf(stderr, "%s: error socket: %s\n", prg_name, strerror(errno));
+			freeaddrinfo(server);
+			return -1;
+		}
+
+		/* socket options are set on API Level (SOL_SOCKET), and optval is nonzero as to enable boolean option; optlen is sizeof int */
+		if(setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(int)) == -1)
+		{
+			fprintf(stderr, "%s: error setsockopt %s\n", prg_name, strerror(errno));
+			close(socket_desc);
+			freeaddrinfo(server);
+			return -1;
+		}
+		/* accept() only returns once data has arrived, so validate_request() can see the request.
+		 * Idle connections (e.g. kept warm by a client agent) are accepted after the timeout
+		 * without data, and their business logic process waits until they are used. */
+		check = DEFER_ACCEPT_SECONDS;
+		if(setsockopt(socket_desc, IPPROTO_TCP, TCP_DEFER_ACCEPT, &check, sizeof(int)) == -1)
+		{
+			fprintf(stderr, "%s: error setsockopt %s\n", prg_name, strerror(errno));
+		}
+		/* if bind is not successful, try with the next address */
+		if(bind(socket_desc, rp->ai_addr, rp->ai_addrlen) == -1)
+		{
+			fprintf(stderr, "%s: error bind %s\n", prg_name, strerror(errno));
+			close(socket_desc);
+			continue;
+		}
+		break;
+	}
+
+	freeaddrinfo(server);
+
+	if(rp == NULL)
+	{
+		fprintf(stderr, "%s: server binding failed\n", prg_name);
+		return -1;
+	}
+
+	/* listen on socket */
+	if(listen(socket_desc, LISTEN) == -1)
+	{
+		fprintf(stderr, "%s: error because of too many connections %s\n", prg_name, strerror(errno));
+		close(socket_desc);
+		return -1;
+	}
+
+	return socket_desc;
+}
+/**
+ *
+ * \brief create_unix_listen_socket function binds a unix domain socket and starts listening
+ *
+ *
+ * \param unix_address passes the address of the unix domain socket
+ * \param unix_address_length passes the length of the address
+ *
+ * \return listening socket descriptor
+ * \return -1 on error
+ *
+ */
+int create_unix_listen_socket(const struct sockaddr_un *unix_address, socklen_t unix_address_length)
+{
+	int socket_desc;
+
+	socket_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(socket_desc == -1)
+	{
+		fprintf(stderr, "%s: error socket: %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	/* remove a stale socket file of a previous run, but never a file of someone else */
+	if(sms_remove_stale_socket(unix_address, unix_address_length) == -1)
+	{
+		fprintf(stderr, "%s: cannot use %s: %s\n", prg_name, unix_address->sun_path, strerror(errno));
+		close(socket_desc);
+		return -1;
+	}
+
+	if(bind(socket_desc, (const struct sockaddr *) unix_address, unix_address_length) == -1)
+	{
+		fprintf(stderr, "%s: error bind %s\n", prg_name, strerror(errno));
+		close(socket_desc);
+		return -1;
+	}
+
+	if(listen(socket_desc, LISTEN) == -1)
+	{
+		fprintf(stderr, "%s: error because of too many connections %s\n", prg_name, strerror(errno));
+		close(socket_desc);
+		return -1;
+	}
+
+	return socket_desc;
+}
+/**
+ *
+ * \brief receive_listen_socket function takes over the listening socket of a running server
+ *
+ * Connects to the handoff socket of the old server and receives the listening
+ * socket descriptor with SCM_RIGHTS. The old server stops accepting afterwards.
+ * A socket offered by a process of another user is not taken.
+ *
+ * \param path passes the path of the handoff unix socket
+ *
+ * \return listening socket descriptor
+ * \return -1 if no server is running or the handoff failed
+ *
+ */
+int receive_listen_socket(const char *path)
+{
+	struct sockaddr_un handoff_address;
+	int handoff_desc;
+	char dummy;
+	ssize_t bytes_read;
+	int socket_desc = -1;
+
+	if(strlen(path) >= sizeof(handoff_address.sun_path))
+	{
+		fprintf(stderr, "%s: handoff path too long\n", prg_name);
+		return -1;
+	}
+
+	memset(&handoff_address, 0, sizeof(handoff_address));
+	handoff_address.sun_family = AF_UNIX;
+	strcpy(handoff_address.sun_path, path);
+
+	handoff_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(handoff_desc == -1)
+	{
+		fprintf(stderr, "%s: error socket: %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	/* nobody is listening - this is a cold start */
+	if(connect(handoff_desc, (struct sockaddr *) &handoff_address, sizeof(handoff_address)) == -1)
+	{
+		close(handoff_desc);
+		return -1;
+	}
+
+	/* only a server of the same user may pass in the socket */
+	if(sms_peer_is_own_user(handoff_desc) != 1)
+	{
+		fprintf(stderr, "%s: handoff socket %s belongs to another user\n", prg_name, path);
+		close(handoff_desc);
+		return -1;
+	}
+
+	socket_desc = sms_receive_fd(handoff_desc);
+	if(socket_desc == -1)
+	{
+		fprintf(stderr, "%s: handoff did not contain a socket\n", prg_name);
+	}
+	else
+	{
+		/* the old server closes the connection after its handoff socket, wait for that
+		 * so that create_handoff_socket() finds the socket file stale */
+		do
+		{
+			bytes_read = read(handoff_desc, &dummy, sizeof(dummy));
+		} while(bytes_read > 0 || (bytes_read == -1 && errno == EINTR));
+	}
+	close(handoff_desc);
+
+	return socket_desc;
+}
+/**
+ *
+ * \brief create_handoff_socket function creates the unix socket a new server can take the listening socket from
+ *
+ * The socket file is created with mode 0600, so only the user running the server can connect.
+ *
+ * \param path passes the path of the handoff unix socket
+ *
+ * \return handoff socket descriptor
+ * \return -1 on error
+ *
+ */
+int create_handoff_socket(const char *path)
+{
+	struct sockaddr_un handoff_address;
+	int handoff_desc;
+	int check;
+	mode_t old_mask;
+
+	if(strlen(path) >= sizeof(handoff_address.sun_path))
+	{
+		fprintf(stderr, "%s: handoff path too long\n", prg_name);
+		return -1;
+	}
+
+	memset(&handoff_address, 0, sizeof(handoff_address));
+	handoff_address.sun_family = AF_UNIX;
+	strcpy(handoff_address.sun_path, path);
+
+	handoff_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(handoff_desc == -1)
+	{
+		fprintf(stderr, "%s: error socket: %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	/* the old server (if any) has already handed over and closed its handoff socket */
+	if(sms_remove_stale_socket(&handoff_address, sizeof(handoff_address)) == -1)
+	{
+		fprintf(stderr, "%s: cannot use %s: %s\n", prg_name, path, strerror(errno));
+		close(handoff_desc);
+		return -1;
+	}
+	/* socket file with mode 0600 - other users cannot even connect */
+	old_mask = umask(0177);
+	check = bind(handoff_desc, (struct sockaddr *) &handoff_address, sizeof(handoff_address));
+	umask(old_mask);
+	if(check == -1)
+	{
+		fprintf(stderr, "%s: error bind %s: %s\n", prg_name, path, strerror(errno));
+		close(handoff_desc);
+		return -1;
+	}
+
+	if(listen(handoff_desc, 1) == -1)
+	{
+		fprintf(stderr, "%s: error listen %s\n", prg_name, strerror(errno));
+		close(handoff_desc);
+		return -1;
+	}
+
+	return handoff_desc;
+}
+/**
+ *
+ * \brief hand_over_listen_socket function sends the listening socket to a new server
+ *
+ * The socket is only sent if the new server runs as the same user (SO_PEERCRED).
+ *
+ * \param handoff_desc passes the handoff socket descriptor
+ * \param socket_desc passes the listening socket descriptor
+ *
+ * \return 0 if the new server got the socket (handoff_desc is closed then)
+ * \return -1 on error (the old server keeps on accepting)
+ *
+ */
+int hand_over_listen_socket(int handoff_desc, int socket_desc)
+{
+	int new_server_desc;
+
+	new_server_desc = accept(handoff_desc, NULL, NULL);
+	if(new_server_desc == -1)
+	{
+		fprintf(stderr, "%s: error accept handoff %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	/* the listening socket is only handed to a server of the same user */
+	if(sms_peer_is_own_user(new_server_desc) != 1)
+	{
+		fprintf(stderr, "%s: handoff refused - peer runs as another user\n", prg_name);
+		close(new_server_desc);
+		return -1;
+	}
+
+	if(sms_send_fd(new_server_desc, socket_desc) == -1)
+	{
+		fprintf(stderr, "%s: error sendmsg %s\n", prg_name, strerror(errno));
+		close(new_server_desc);
+		return -1;
+	}
+
+	/* close the handoff socket first - the new server waits for the end of the connection */
+	close(handoff_desc);
+	close(new_server_desc);
+	return 0;
+}
+/**
+ *
+ * \brief drain_children function waits until all running children have finished
+ *
+ *
+ */
+void drain_children(void)
+{
+	/* children are reaped here now, not in the signal handler */
+	signal(SIGCHLD, SIG_DFL);
+	while(waitpid(-1, NULL, 0) != -1 || errno == EINTR);
+}
+/**
+ *
+ * \brief validate_request function checks the start of a request before a child is forked
+ *
+ * The request is only peeked at (MSG_PEEK), so the bytes stay in the socket and the
+ * business logic reads them as before. Requests that are empty or do not start with a
+ * non-empty user= line get an error status right away.
+ *
+ * On a TCP listener TCP_DEFER_ACCEPT makes accept() wait for the first bytes. A unix
+ * domain socket has no such option, so the socket is polled for up to VALIDATE_WAIT_MS
+ * first. A client that sends nothing within that time (on TCP: within
+ * DEFER_ACCEPT_SECONDS plus that time, e.g. a warm connection of a client agent) is
+ * passed on unchecked, and the business logic decides.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ *
+ * \return 0 if the request is passed on to the business logic
+ * \return -1 if the request was rejected (socket has to be closed)
+ *
+ */
+int validate_request(int socket_desc)
+{
+	char peek_buffer[PEEK_SIZE];
+	struct pollfd request_poll = { socket_desc, POLLIN, 0 };
+	ssize_t bytes_peeked;
+	size_t compare_length;
+	size_t prefix_length = strlen(USER_PREFIX);
+
+	/* a short wait only, slow clients must not hold up the accept loop */
+	poll(&request_poll, 1, VALIDATE_WAIT_MS);
+	bytes_peeked = recv(socket_desc, peek_buffer, sizeof(peek_buffer), MSG_PEEK | MSG_DONTWAIT);
+	if(bytes_peeked == -1)
+	{
+		/* nothing sent yet - do not wait for slow clients here */
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return 0;
+		}
+		return -1;
+	}
+
+	/* query requests are checked when they are answered */
+	if(bytes_peeked > 0 && board_dir != NULL)
+	{
+		compare_length = ((size_t) bytes_peeked < strlen(SMS_BOARD_QUERY_PREFIX)) ? (size_t) bytes_peeked
+				: strlen(SMS_BOARD_QUERY_PREFIX);
+		if(memcmp(peek_buffer, SMS_BOARD_QUERY_PREFIX, compare_length) == 0)
+		{
+			return 0;
+		}
+	}
+
+	if(bytes_peeked > 0)
+	{
+		compare_length = ((size_t) bytes_peeked < prefix_length) ? (size_t) bytes_peeked : prefix_length;
+		if(memcmp(peek_buffer, USER_PREFIX, compare_length) == 0)
+		{
+			/* user name must not be empty (if the line has already arrived) */
+			if((size_t) bytes_peeked <= prefix_length
+					|| (peek_buffer[prefix_length] != '\n' && peek_buffer[prefix_length] != '\r'))
+			{
+				return 0;
+			}
+		}
+	}
+
+	/* empty request, missing user= line or empty user name - consume what was peeked,
+	 * otherwise close() resets the connection before the client has read the status */
+	if(bytes_peeked > 0 && recv(socket_desc, peek_buffer, (size_t) bytes_peeked, MSG_DONTWAIT) == -1)
+	{
+		return -1;
+	}
+	if(send(socket_desc, INVALID_REQUEST_RESPONSE, strlen(INVALID_REQUEST_RESPONSE), MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+	{
+		fprintf(stderr, "%s: error send %s\n", prg_name, strerror(errno));
+	}
+	return -1;
+}
+/**
+ *
+ * \brief has_header_extension function checks if a header line for the server follows the user line
+ *
+ * The request is peeked at (MSG_PEEK) until the user line and the start of the next line
+ * have arrived, or the client has finished sending. Only as many bytes are waited for as
+ * the prefix that still matches is long: a client uploading an image waits for
+ * CONTINUE_LINE after its imgfile= and len= lines, which are longer than IMGFILE_PREFIX,
+ * and an accept-encoding= line is always sent completely, so the client cannot be blocked.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ *
+ * \return 1 if the line after the user line is an imgfile= or accept-encoding= line
+ * \return 0 otherwise
+ *
+ */
+int has_header_extension(int socket_desc)
+{
+	static const char *const prefixes[] = { IMGFILE_PREFIX, ACCEPT_ENCODING_PREFIX };
+	char peek_buffer[HEADER_SIZE];
+	/* shortest possible user line */
+	size_t wanted = strlen(USER_PREFIX) + 2;
+	size_t next_wanted;
+	size_t line_length;
+	size_t available;
+	size_t prefix_length;
+	size_t i;
+	char *line_end;
+	ssize_t bytes_peeked;
+
+	for(;;)
+	{
+		do
+		{
+			bytes_peeked = recv(socket_desc, peek_buffer, wanted, MSG_PEEK | MSG_WAITALL);
+		} while(bytes_peeked == -1 && errno == EINTR);
+		if(bytes_peeked <= 0)
+		{
+			return 0;
+		}
+
+		line_end = memchr(peek_buffer, '\n', (size_t) bytes_peeked);
+		if(line_end != NULL)
+		{
+			line_length = (size_t) (line_end - peek_buffer) + 1;
+			available = (size_t) bytes_peeked - line_length;
+			next_wanted = 0;
+			for(i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+			{
+				prefix_length = strlen(prefixes[i]);
+				if(memcmp(peek_buffer + line_length, prefixes[i], available < prefix_length ? available : prefix_length) != 0)
+				{
+					continue;
+				}
+				if(available >= prefix_length)
+				{
+					return 1;
+				}
+				/* the shortest prefix still matching decides how many bytes are waited for */
+				if(next_wanted == 0 || line_length + prefix_length < next_wanted)
+				{
+					next_wanted = line_length + prefix_length;
+				}
+			}
+			if(next_wanted == 0)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			/* the user line is longer than the bytes peeked, and it is sent completely */
+			next_wanted = wanted + strlen(IMGFILE_PREFIX);
+		}
+
+		/* the client has finished sending, or the user line does not fit */
+		if((size_t) bytes_peeked < wanted || next_wanted > sizeof(peek_buffer))
+		{
+			return 0;
+		}
+		wanted = next_wanted;
+	}
+}
+/**
+ *
+ * \brief prepare_request function reads the request header and stores an uploaded image
+ *
+ * An "imgfile=<name>" and "len=<length>" record after the user line is stored in the
+ * image store and replaced by an "img=<URL>" line for the business logic. The client
+ * sends the image after CONTINUE_LINE. Without an image store, or if the image is larger
+ * than --image-max, it gets an error status instead. An
+ * "accept-encoding=" line is taken out of the request, also without --compress, as the
+ * business logic would take it for the message. The rewritten header and the rest of
+ * the request are relayed to the business logic through a pipe.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ * \param arrival_ns passes the time the connection was accepted (for the capture file)
+ * \param deflate_response returns 1 if the client accepts compressed files and --compress is given, 0 otherwise
+ * \param post_desc returns the pipe the post for the board index is read from, -1 without --board
+ *
+ * \return descriptor the business logic reads the request from
+ * \return -1 on error (an error status has been sent to the client)
+ *
+ */
+int prepare_request(int socket_desc, uint64_t arrival_ns, int *deflate_response, int *post_desc)
+{
+	static struct request_header header;
+	char rewritten[HEADER_SIZE + PATH_MAX];
+	char name[NAME_MAX + 1];
+	char url[PATH_MAX];
+	size_t rewritten_length = 0;
+	size_t line_length;
+	char *line;
+	char *end_ptr;
+	long length;
+	int check;
+
+	header.socket_desc = socket_desc;
+	header.length = 0;
+	header.position = 0;
+	*post_desc = -1;
+
+	/* user line is passed on unchanged */
+	line = next_header_line(&header, &line_length);
+	if(line != NULL)
+	{
+		memcpy(rewritten, line, line_length);
+		rewritten_length = line_length;
+		header.position += line_length;
+
+		line = next_header_line(&header, &line_length);
+	}
+
+	/* the business logic does not know this line */
+	*deflate_response = 0;
+	if(line != NULL && strncmp(line, ACCEPT_ENCODING_PREFIX, strlen(ACCEPT_ENCODING_PREFIX)) == 0)
+	{
+		header.position += line_length;
+		*deflate_response = compress_responses && line_length == strlen(ACCEPT_ENCODING) + 1
+				&& strncmp(line, ACCEPT_ENCODING, strlen(ACCEPT_ENCODING)) == 0;
+
+		line = next_header_line(&header, &line_length);
+	}
+
+	/* handled without --image-store as well, the upload is refused then */
+	if(line != NULL && strncmp(line, IMGFILE_PREFIX, strlen(IMGFILE_PREFIX)) == 0)
+	{
+		header.position += line_length;
+		/* name without line end */
+		line_length -= strlen(IMGFILE_PREFIX);
+		line += strlen(IMGFILE_PREFIX);
+		while(line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r'))
+		{
+			line_length--;
+		}
+		if(line_length >= sizeof(name))
+		{
+			line_length = sizeof(name) - 1;
+		}
+		memcpy(name, line, line_length);
+		name[line_length] = '\0';
+
+		length = -1;
+		line = next_header_line(&header, &line_length);
+		if(line != NULL && strncmp(line, LEN_PREFIX, strlen(LEN_PREFIX)) == 0)
+		{
+			header.position += line_length;
+			errno = 0;
+			length = strtol(line + strlen(LEN_PREFIX), &end_ptr, STRTOL_BASE);
+			if(errno != 0 || end_ptr == line + strlen(LEN_PREFIX))
+			{
+				length = -1;
+			}
+		}
+
+		check = -1;
+		if(image_store == NULL)
+		{
+			fprintf(stderr, "%s: image upload refused, no image store\n", prg_name);
+		}
+		else if(length > image_max)
+		{
+			fprintf(stderr, "%s: image upload of %ld bytes refused, limit %ld\n", prg_name, length, image_max);
+		}
+		else if(length >= 0)
+		{
+			/* the client sends the image only after this go-ahead */
+			check = sms_write_all(socket_desc, CONTINUE_LINE, strlen(CONTINUE_LINE));
+			if(check == 0)
+			{
+				check = store_image(&header, name, length, url, sizeof(url));
+			}
+		}
+		if(check == -1)
+		{
+			if(sms_write_all(socket_desc, INVALID_REQUEST_RESPONSE, strlen(INVALID_REQUEST_RESPONSE)) == -1)
+			{
+				fprintf(stderr, "%s: error write %s\n", prg_name, strerror(errno));
+			}
+			return -1;
+		}
+
+		rewritten_length += (size_t) snprintf(rewritten + rewritten_length, sizeof(rewritten) - rewritten_length, "img=%s\n", url);
+	}
+
+	return relay_request(socket_desc, rewritten, rewritten_length,
+			header.buffer + header.position, header.length - header.position, arrival_ns, post_desc);
+}
+/**
+ *
+ * \brief next_header_line function returns the next complete line of the request header
+ *
+ * Reads from the socket until the line is complete. The line is not consumed, the caller
+ * advances header->position if it uses the line.
+ *
+ * \param header passes the request header read so far
+ * \param line_length returns the length of the line including '\n'
+ *
+ * \return pointer to the line in the header buffer
+ * \return NULL if the request ended or the line does not fit into the header buffer
+ *
+ */
+char *next_header_line(struct request_header *header, size_t *line_length)
+{
+	char *line = header->buffer + header->position;
+	char *line_end;
+	ssize_t bytes_read;
+
+	for(;;)
+	{
+		line_end = memchr(line, '\n', header->length - header->position);
+		if(line_end != NULL)
+		{
+			*line_length = (size_t) (line_end - line) + 1;
+			return line;
+		}
+		if(header->length == sizeof(header->buffer))
+		{
+			return NULL;
+		}
+
+		bytes_read = read(header->socket_desc, header->buffer + header->length, sizeof(header->buffer) - header->length);
+		if(bytes_read == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes_read <= 0)
+		{
+			return NULL;
+		}
+		header->length += (size_t) bytes_read;
+	}
+}
+/**
+ *
+ * \brief store_image function stores an uploaded image under its content hash
+ *
+ * The image is written to a temporary file and linked to <hash>-<length><extension>.
+ * If this file exists already with the same content (same avatar uploaded before) the
+ * upload is discarded. A different image with the same hash is stored as
+ * <hash>-<length>-<n><extension>, so a planted collision cannot replace an image.
+ *
+ * \param header passes the request header, may already contain the start of the image
+ * \param name passes the file name sent by the client (used for the extension)
+ * \param length passes the length of the image
+ * \param url returns the URL of the stored image
+ * \param url_size passes the size of url
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int store_image(struct request_header *header, const char *name, long length, char *url, size_t url_size)
+{
+	static char chunk[CHUNK_SIZE];
+	char temp_path[PATH_MAX];
+	char image_path[PATH_MAX];
+	char extension[EXTENSION_MAX + 1] = "";
+	const char *dot;
+	unsigned long long hash = SMS_FNV1A_OFFSET_BASIS;
+	size_t remaining = (size_t) length;
+	size_t chunk_length;
+	size_t i;
+	ssize_t bytes_read;
+	int image_fd;
+	int collisions;
+
+	snprintf(temp_path, sizeof(temp_path), "%s/.upload.XXXXXX", image_store);
+	image_fd = mkstemp(temp_path);
+	if(image_fd == -1)
+	{
+		fprintf(stderr, "%s: cannot create %s: %s\n", prg_name, temp_path, strerror(errno));
+		return -1;
+	}
+
+	while(remaining > 0)
+	{
+		/* bytes already read together with the header come first */
+		if(header->position < header->length)
+		{
+			chunk_length = header->length - header->position;
+			if(chunk_length > remaining)
+			{
+				chunk_length = remaining;
+			}
+			memcpy(chunk, header->buffer + header->position, chunk_length);
+			header->position += chunk_length;
+		}
+		else
+		{
+			bytes_read = read(header->socket_desc, chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+			if(bytes_read == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if(bytes_read <= 0)
+			{
+				fprintf(stderr, "%s: image upload incomplete\n", prg_name);
+				close(image_fd);
+				unlink(temp_path);
+				return -1;
+			}
+			chunk_length = (size_t) bytes_read;
+		}
+
+		hash = sms_fnv1a(hash, chunk, chunk_length);
+		if(sms_write_all(image_fd, chunk, chunk_length) == -1)
+		{
+			fprintf(stderr, "%s: cannot write %s: %s\n", prg_name, temp_path, strerror(errno));
+			close(image_fd);
+			unlink(temp_path);
+			return -1;
+		}
+		remaining -= chunk_length;
+	}
+
+	/* keep a short alphanumeric extension, browsers need it to show the image */
+	dot = strrchr(name, '.');
+	if(dot != NULL && dot[1] != '\0' && strlen(dot) <= EXTENSION_MAX)
+	{
+		for(i = 1; isalnum((unsigned char) dot[i]); i++);
+		if(dot[i] == '\0')
+		{
+			strcpy(extension, dot);
+		}
+	}
+
+	/* mkstemp creates the file for the owner only, the image is read by the web server */
+	if(fchmod(image_fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 || close(image_fd) == -1)
+	{
+		fprintf(stderr, "%s: cannot write %s: %s\n", prg_name, temp_path, strerror(errno));
+		unlink(temp_path);
+		return -1;
+	}
+
+	/* link() does not replace an existing file: the first name that is free or already
+	 * holds the same content (same image uploaded before) is used */
+	for(collisions = 0; ; collisions++)
+	{
+		if(collisions == 0)
+		{
+			snprintf(image_path, sizeof(image_path), "%s/%016llx-%ld%s", image_store, hash, length, extension);
+		}
+		else
+		{
+			snprintf(image_path, sizeof(image_path), "%s/%016llx-%ld-%d%s", image_store, hash, length, collisions, extension);
+		}
+		if(link(temp_path, image_path) == 0)
+		{
+			break;
+		}
+		if(errno != EEXIST || collisions == IMAGE_COLLISIONS_MAX)
+		{
+			fprintf(stderr, "%s: cannot store %s: %s\n", prg_name, image_path, strerror(errno));
+			unlink(temp_path);
+			return -1;
+		}
+		if(same_content(temp_path, image_path) == 1)
+		{
+			break;
+		}
+	}
+	unlink(temp_path);
+
+	snprintf(url, url_size, "%s%s", image_url, strrchr(image_path, '/') + 1);
+	return 0;
+}
+/**
+ *
+ * \brief same_content function compares the contents of two files
+ *
+ *
+ * \param path passes the first file
+ * \param other_path passes the second file
+ *
+ * \return 1 if both files have the same content
+ * \return 0 if not, or if a file cannot be read
+ *
+ */
+int same_content(const char *path, const char *other_path)
+{
+	static char chunk[CHUNK_SIZE];
+	static char other_chunk[CHUNK_SIZE];
+	ssize_t bytes_read;
+	ssize_t other_bytes_read;
+	int fd;
+	int other_fd;
+	int same = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	other_fd = open(other_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	while(fd != -1 && other_fd != -1)
+	{
+		bytes_read = read(fd, chunk, sizeof(chunk));
+		other_bytes_read = read(other_fd, other_chunk, sizeof(other_chunk));
+		/* regular files are read in full chunks until the end */
+		if(bytes_read == -1 || bytes_read != other_bytes_read || memcmp(chunk, other_chunk, (size_t) bytes_read) != 0)
+		{
+			break;
+		}
+		if(bytes_read == 0)
+		{
+			same = 1;
+			break;
+		}
+	}
+
+	if(fd != -1)
+	{
+		close(fd);
+	}
+	if(other_fd != -1)
+	{
+		close(other_fd);
+	}
+	return same;
+}
+/**
+ *
+ * \brief relay_request function passes the (rewritten) request to the business logic through a pipe
+ *
+ * A relay process writes the header and the bytes already read to the pipe and then
+ * splices the rest of the request from the socket into the pipe. When requests are
+ * captured or the board index is kept, the rest is copied instead and the whole request
+ * is appended to the capture file once it is complete. With --board the complete request
+ * is then written to the post pipe, the response relay adds it to the board index if the
+ * business logic accepts the post. Only the first capture_max bytes are kept: a longer
+ * request is captured truncated and is not added to the board index.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ * \param header passes the header for the business logic
+ * \param header_length passes the length of the header
+ * \param rest passes bytes read from the socket after the header
+ * \param rest_length passes the number of these bytes
+ * \param arrival_ns passes the time the connection was accepted (for the capture file)
+ * \param post_desc returns the read end of the post pipe, -1 without --board
+ *
+ * \return read end of the pipe
+ * \return -1 on error
+ *
+ */
+int relay_request(int socket_desc, const char *header, size_t header_length, const char *rest, size_t rest_length,
+		uint64_t arrival_ns, int *post_desc)
+{
+	static char chunk[CHUNK_SIZE];
+	struct capture_buffer capture = { NULL, 0, 0 };
+	uint64_t request_length = 0;
+	int pipe_desc[2];
+	/* the business logic must not keep the post pipe open */
+	int post_pipe[2] = { -1, -1 };
+	ssize_t bytes_moved;
+	pid_t relay;
+	int collect = (capture_fd != -1 || board_dir != NULL);
+
+	if(board_dir != NULL && pipe2(post_pipe, O_CLOEXEC) == -1)
+	{
+		fprintf(stderr, "%s: error pipe %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+	if(pipe(pipe_desc) == -1)
+	{
+		fprintf(stderr, "%s: error pipe %s\n", prg_name, strerror(errno));
+		if(post_pipe[0] != -1)
+		{
+			close(post_pipe[0]);
+			close(post_pipe[1]);
+		}
+		return -1;
+	}
+
+	relay = fork();
+	if(relay == -1)
+	{
+		fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
+		close(pipe_desc[0]);
+		close(pipe_desc[1]);
+		if(post_pipe[0] != -1)
+		{
+			close(post_pipe[0]);
+			close(post_pipe[1]);
+		}
+		return -1;
+	}
+	if(relay > 0)
+	{
+		close(pipe_desc[1]);
+		if(post_pipe[1] != -1)
+		{
+			close(post_pipe[1]);
+		}
+		*post_desc = post_pipe[0];
+		return pipe_desc[0];
+	}
+
+	close(pipe_desc[0]);
+	if(post_pipe[0] != -1)
+	{
+		close(post_pipe[0]);
+	}
+	if(sms_write_all(pipe_desc[1], header, header_length) == -1 || sms_write_all(pipe_desc[1], rest, rest_length) == -1)
+	{
+		_exit(EXIT_FAILURE);
+	}
+
+	bytes_moved = -1;
+	errno = EINVAL;
+	if(!collect)
+	{
+		/* rest of the message moves from the socket to the pipe inside the kernel */
+		while((bytes_moved = splice(socket_desc, NULL, pipe_desc[1], NULL, CHUNK_SIZE, SPLICE_F_MOVE)) > 0);
+	}
+	else if(capture_limited(&capture, header, header_length, &request_length) == -1
+			|| capture_limited(&capture, rest, rest_length, &request_length) == -1)
+	{
+		collect = 0;
+	}
+
+	/* sockets which do not support splice and collected requests are copied */
+	if(bytes_moved == -1 && errno == EINVAL)
+	{
+		while((bytes_moved = read(socket_desc, chunk, sizeof(chunk))) > 0)
+		{
+			if(sms_write_all(pipe_desc[1], chunk, (size_t) bytes_moved) == -1)
+			{
+				_exit(EXIT_FAILURE);
+			}
+			if(collect && capture_limited(&capture, chunk, (size_t) bytes_moved, &request_length) == -1)
+			{
+				collect = 0;
+			}
+		}
+	}
+
+	if(collect && bytes_moved == 0)
+	{
+		if(capture_fd != -1 && write_capture_record(arrival_ns, capture.data, capture.length, request_length) == -1)
+		{
+			fprintf(stderr, "%s: cannot write capture %s\n", prg_name, strerror(errno));
+		}
+		/* the business logic has to see the end of the request before it answers */
+		close(pipe_desc[1]);
+		if(board_dir != NULL && request_length > capture.length)
+		{
+			fprintf(stderr, "%s: post of %llu bytes exceeds %ld bytes, not added to board index\n", prg_name,
+					(unsigned long long) request_length, capture_max);
+		}
+		else if(board_dir != NULL)
+		{
+			/* the response relay closes the pipe without reading if the post was not accepted */
+			signal(SIGPIPE, SIG_IGN);
+			if((sms_write_all(post_pipe[1], (const char *) &arrival_ns, sizeof(arrival_ns)) == -1
+					|| sms_write_all(post_pipe[1], capture.data, capture.length) == -1) && errno != EPIPE)
+			{
+				fprintf(stderr, "%s: cannot pass post to board index %s\n", prg_name, strerror(errno));
+			}
+		}
+	}
+
+	_exit(bytes_moved == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+/**
+ *
+ * \brief start_response_relay function starts the process passing the response of the business logic on
+ *
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ * \param deflate_response passes 1 if large files are compressed for the client
+ * \param post_desc passes the post pipe of relay_request(), -1 without --board
+ *
+ * \return descriptor the business logic writes its response to
+ * \return -1 on error
+ *
+ */
+int start_response_relay(int socket_desc, int deflate_response, int post_desc)
+{
+	int pipe_desc[2];
+	pid_t relay;
+
+	if(pipe(pipe_desc) == -1)
+	{
+		fprintf(stderr, "%s: error pipe %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	relay = fork();
+	if(relay == -1)
+	{
+		fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
+		close(pipe_desc[0]);
+		close(pipe_desc[1]);
+		return -1;
+	}
+	if(relay == 0)
+	{
+		close(pipe_desc[1]);
+		run_response_relay(pipe_desc[0], socket_desc, deflate_response, post_desc);
+	}
+
+	close(pipe_desc[0]);
+	if(post_desc != -1)
+	{
+		close(post_desc);
+	}
+	return pipe_desc[1];
+}
+/**
+ *
+ * \brief run_response_relay function passes the response to the client, compressing large file= records
+ *
+ * Header lines are passed on unchanged. If the client accepts compressed files, a record
+ * with at least COMPRESS_MIN bytes is sent as "file=<name>", "encoding=deflate",
+ * "len=<compressed length>" and the deflate data from compress_payload().
+ * With --board the post is added to the board index if the response starts with
+ * "status=0", i.e. the business logic accepted it.
+ *
+ * \param logic_desc passes the pipe the business logic writes its response to
+ * \param socket_desc passes the accepted socket descriptor
+ * \param deflate_response passes 1 if large files are compressed for the client
+ * \param post_desc passes the post pipe of relay_request(), -1 without --board
+ *
+ */
+void run_response_relay(int logic_desc, int socket_desc, int deflate_response, int post_desc)
+{
+	static char chunk[CHUNK_SIZE];
+	char line[HEADER_SIZE];
+	char *end_ptr;
+	FILE *logic;
+	off_t compressed_length;
+	off_t offset;
+	ssize_t bytes_sent;
+	size_t remaining;
+	size_t chunk_length;
+	long length;
+	int compressed_fd;
+	int line_length;
+
+	logic = fdopen(logic_desc, "r");
+	if(logic == NULL)
+	{
+		_exit(EXIT_FAILURE);
+	}
+
+	while(fgets(line, sizeof(line), logic) != NULL)
+	{
+		/* the first line is the status of the post */
+		if(post_desc != -1)
+		{
+			if(strncmp(line, STATUS_PREFIX, strlen(STATUS_PREFIX)) == 0
+					&& strtol(line + strlen(STATUS_PREFIX), &end_ptr, STRTOL_BASE) == 0
+					&& end_ptr != line + strlen(STATUS_PREFIX)
+					&& board_append_post(post_desc) == -1)
+			{
+				fprintf(stderr, "%s: cannot add post to board index %s\n", prg_name, strerror(errno));
+			}
+			close(post_desc);
+			post_desc = -1;
+		}
+
+		length = -1;
+		if(strncmp(line, LEN_PREFIX, strlen(LEN_PREFIX)) == 0)
+		{
+			errno = 0;
+			length = strtol(line + strlen(LEN_PREFIX), &end_ptr, STRTOL_BASE);
+			if(errno != 0 || end_ptr == line + strlen(LEN_PREFIX))
+			{
+				length = -1;
+			}
+		}
+
+		/* status= and file= lines, small and large files */
+		if(!deflate_response || length < COMPRESS_MIN)
+		{
+			if(sms_write_all(socket_desc, line, strlen(line)) == -1)
+			{
+				_exit(EXIT_FAILURE);
+			}
+			for(remaining = (length > 0) ? (size_t) length : 0; remaining > 0; remaining -= chunk_length)
+			{
+				chunk_length = fread(chunk, 1, remaining < sizeof(chunk) ? remaining : sizeof(chunk), logic);
+				if(chunk_length == 0 || sms_write_all(socket_desc, chunk, chunk_length) == -1)
+				{
+					_exit(EXIT_FAILURE);
+				}
+			}
+			continue;
+		}
+
+		if(compress_payload(logic, (size_t) length, &compressed_fd, &compressed_length) == -1)
+		{
+			_exit(EXIT_FAILURE);
+		}
+
+		line_length = snprintf(line, sizeof(line), "%s%s%lld\n", ENCODING_LINE, LEN_PREFIX, (long long) compressed_length);
+		if(sms_write_all(socket_desc, line, (size_t) line_length) == -1)
+		{
+			_exit(EXIT_FAILURE);
+		}
+		for(offset = 0; offset < compressed_length; )
+		{
+			/* sendfile() advances offset */
+			bytes_sent = sendfile(socket_desc, compressed_fd, &offset, (size_t) (compressed_length - offset));
+			if(bytes_sent <= 0)
+			{
+				_exit(EXIT_FAILURE);
+			}
+		}
+		close(compressed_fd);
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+/**
+ *
+ * \brief compress_payload function returns the compressed copy of a file= payload
+ *
+ * Without --compress-cache the payload is compressed while it is read, into an unlinked
+ * temporary file. With a cache the payload is first copied into an unlinked file in the
+ * cache directory and hashed (FNV-1a 64 bit). A cached <hash>-<length>.deflate is only
+ * used if it inflates to exactly the payload, otherwise the payload is compressed and
+ * replaces it, and the cache is trimmed to --compress-cache-max.
+ *
+ * \param logic passes the response stream of the business logic
+ * \param length passes the length of the payload
+ * \param compressed_fd returns the descriptor of the compressed copy (read from the start)
+ * \param compressed_length returns the length of the compressed copy
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int compress_payload(FILE *logic, size_t length, int *compressed_fd, off_t *compressed_length)
+{
+	static char chunk[CHUNK_SIZE];
+	char raw_path[PATH_MAX];
+	char temp_path[PATH_MAX];
+	char cache_path[PATH_MAX];
+	struct stat file_status;
+	unsigned long long hash = SMS_FNV1A_OFFSET_BASIS;
+	FILE *raw;
+	FILE *temp;
+	size_t remaining;
+	size_t chunk_length;
+	int raw_fd;
+
+	if(compress_cache == NULL)
+	{
+		temp = tmpfile();
+		if(temp == NULL)
+		{
+			fprintf(stderr, "%s: cannot create temporary file: %s\n", prg_name, strerror(errno));
+			return -1;
+		}
+		*compressed_fd = dup(fileno(temp));
+		fclose(temp);
+		if(*compressed_fd == -1 || deflate_payload(logic, length, *compressed_fd) == -1)
+		{
+			fprintf(stderr, "%s: cannot compress %zu bytes\n", prg_name, length);
+			if(*compressed_fd != -1)
+			{
+				close(*compressed_fd);
+			}
+			return -1;
+		}
+	}
+	else
+	{
+		snprintf(raw_path, sizeof(raw_path), "%s/.raw.XXXXXX", compress_cache);
+		raw_fd = mkstemp(raw_path);
+		if(raw_fd == -1)
+		{
+			fprintf(stderr, "%s: cannot create %s: %s\n", prg_name, raw_path, strerror(errno));
+			return -1;
+		}
+		unlink(raw_path);
+		raw = fdopen(raw_fd, "w+");
+		if(raw == NULL)
+		{
+			close(raw_fd);
+			return -1;
+		}
+
+		for(remaining = length; remaining > 0; remaining -= chunk_length)
+		{
+			chunk_length = fread(chunk, 1, remaining < sizeof(chunk) ? remaining : sizeof(chunk), logic);
+			if(chunk_length == 0 || fwrite(chunk, 1, chunk_length, raw) != chunk_length)
+			{
+				fclose(raw);
+				return -1;
+			}
+			hash = sms_fnv1a(hash, chunk, chunk_length);
+		}
+
+		snprintf(cache_path, sizeof(cache_path), "%s/%016llx-%zu" COMPRESS_CACHE_SUFFIX, compress_cache, hash, length);
+		*compressed_fd = open(cache_path, O_RDONLY);
+		if(*compressed_fd != -1 && cached_payload_matches(*compressed_fd, raw, length) == 1)
+		{
+			/* the modification time orders the cache for trim_compress_cache() */
+			utimensat(AT_FDCWD, cache_path, NULL, 0);
+		}
+		else
+		{
+			/* not in the cache yet, or a different payload with the same hash */
+			if(*compressed_fd != -1)
+			{
+				close(*compressed_fd);
+			}
+			snprintf(temp_path, sizeof(temp_path), "%s/.deflate.XXXXXX", compress_cache);
+			*compressed_fd = mkstemp(temp_path);
+			if(*compressed_fd == -1)
+			{
+				fprintf(stderr, "%s: cannot create %s: %s\n", prg_name, temp_path, strerror(errno));
+				fclose(raw);
+				return -1;
+			}
+			rewind(raw);
+			if(deflate_payload(raw, length, *compressed_fd) == -1 || rename(temp_path, cache_path) == -1)
+			{
+				fprintf(stderr, "%s: cannot compress into %s: %s\n", prg_name, cache_path, strerror(errno));
+				unlink(temp_path);
+				close(*compressed_fd);
+				fclose(raw);
+				return -1;
+			}
+			trim_compress_cache();
+		}
+		fclose(raw);
+	}
+
+	if(fstat(*compressed_fd, &file_status) == -1)
+	{
+		close(*compressed_fd);
+		return -1;
+	}
+	*compressed_length = file_status.st_size;
+
+	return 0;
+}
+/**
+ *
+ * \brief deflate_payload function compresses a payload with zlib (fastest level) into a file
+ *
+ *
+ * \param in passes the stream the payload is read from
+ * \param length passes the length of the payload
+ * \param compressed_fd passes the (empty) file the compressed data is written to
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int deflate_payload(FILE *in, size_t length, int compressed_fd)
+{
+	static unsigned char chunk[CHUNK_SIZE];
+	static unsigned char out[CHUNK_SIZE];
+	z_stream stream;
+	size_t remaining = length;
+	size_t chunk_length;
+	int flush;
+	int check = Z_OK;
+
+	memset(&stream, 0, sizeof(stream));
+	if(deflateInit(&stream, Z_BEST_SPEED) != Z_OK)
+	{
+		return -1;
+	}
+
+	do
+	{
+		chunk_length = fread(chunk, 1, remaining < sizeof(chunk) ? remaining : sizeof(chunk), in);
+		if(chunk_length == 0 && remaining > 0)
+		{
+			break;
+		}
+		remaining -= chunk_length;
+		flush = (remaining == 0) ? Z_FINISH : Z_NO_FLUSH;
+		stream.next_in = chunk;
+		stream.avail_in = (uInt) chunk_length;
+		do
+		{
+			stream.next_out = out;
+			stream.avail_out = sizeof(out);
+			check = deflate(&stream, flush);
+			if(check == Z_STREAM_ERROR
+					|| sms_write_all(compressed_fd, (char *) out, sizeof(out) - stream.avail_out) == -1)
+			{
+				deflateEnd(&stream);
+				return -1;
+			}
+		} while(stream.avail_out == 0);
+	} while(flush != Z_FINISH);
+
+	deflateEnd(&stream);
+	if(remaining > 0 || check != Z_STREAM_END)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief cached_payload_matches function checks if a cached compressed copy inflates to the payload
+ *
+ * The name of a cache file only holds the hash and the length of the payload, so a hit
+ * is compared byte by byte before it is sent.
+ *
+ * \param compressed_fd passes the cache file (read from the start, rewound afterwards)
+ * \param raw passes the payload (read from the start)
+ * \param length passes the length of the payload
+ *
+ * \return 1 if the cache file inflates to exactly the payload
+ * \return 0 otherwise
+ *
+ */
+int cached_payload_matches(int compressed_fd, FILE *raw, size_t length)
+{
+	static unsigned char in[CHUNK_SIZE];
+	static unsigned char out[CHUNK_SIZE];
+	static unsigned char expected[CHUNK_SIZE];
+	z_stream stream;
+	ssize_t bytes_read;
+	size_t remaining = length;
+	size_t inflated;
+	int check = Z_OK;
+
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit(&stream) != Z_OK)
+	{
+		return 0;
+	}
+
+	rewind(raw);
+	while(check != Z_STREAM_END)
+	{
+		bytes_read = read(compressed_fd, in, sizeof(in));
+		if(bytes_read <= 0)
+		{
+			break;
+		}
+		stream.next_in = in;
+		stream.avail_in = (uInt) bytes_read;
+		do
+		{
+			stream.next_out = out;
+			stream.avail_out = sizeof(out);
+			check = inflate(&stream, Z_NO_FLUSH);
+			if(check != Z_OK && check != Z_STREAM_END)
+			{
+				inflateEnd(&stream);
+				return 0;
+			}
+			inflated = sizeof(out) - stream.avail_out;
+			if(inflated > remaining || fread(expected, 1, inflated, raw) != inflated
+					|| memcmp(out, expected, inflated) != 0)
+			{
+				inflateEnd(&stream);
+				return 0;
+			}
+			remaining -= inflated;
+		} while(stream.avail_out == 0 && check != Z_STREAM_END);
+	}
+
+	inflateEnd(&stream);
+	if(check != Z_STREAM_END || remaining > 0 || stream.avail_in > 0
+			|| lseek(compressed_fd, 0, SEEK_SET) == -1)
+	{
+		return 0;
+	}
+
+	return 1;
+}
+/**
+ *
+ * \brief compare_cache_entries function compares the modification times of two cache files for qsort()
+ *
+ * \param left passes the first cache file
+ * \param right passes the second cache file
+ *
+ * \return <0, 0 or >0 like strcmp()
+ *
+ */
+int compare_cache_entries(const void *left, const void *right)
+{
+	const struct cache_entry *a = left;
+	const struct cache_entry *b = right;
+
+	return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+/**
+ *
+ * \brief trim_compress_cache function removes the least recently used cache files above --compress-cache-max
+ *
+ * Cache hits update the modification time of their file. Several servers may trim at
+ * the same time; a file removed while it is sent stays readable through its descriptor.
+ *
+ */
+void trim_compress_cache(void)
+{
+	struct cache_entry *entries = NULL;
+	struct cache_entry *grown;
+	struct dirent *entry;
+	struct stat file_status;
+	size_t entry_count = 0;
+	size_t entry_space = 0;
+	size_t name_length;
+	size_t i;
+	long long total = 0;
+	DIR *cache;
+
+	cache = opendir(compress_cache);
+	if(cache == NULL)
+	{
+		fprintf(stderr, "%s: cannot open %s: %s\n", prg_name, compress_cache, strerror(errno));
+		return;
+	}
+
+	while((entry = readdir(cache)) != NULL)
+	{
+		name_length = strlen(entry->d_name);
+		if(entry->d_name[0] == '.' || name_length >= sizeof(entries->name)
+				|| name_length < strlen(COMPRESS_CACHE_SUFFIX)
+				|| strcmp(entry->d_name + name_length - strlen(COMPRESS_CACHE_SUFFIX), COMPRESS_CACHE_SUFFIX) != 0
+				|| fstatat(dirfd(cache), entry->d_name, &file_status, AT_SYMLINK_NOFOLLOW) == -1
+				|| !S_ISREG(file_status.st_mode))
+		{
+			continue;
+		}
+		if(entry_count == entry_space)
+		{
+			entry_space = (entry_space == 0) ? 64 : entry_space * 2;
+			grown = realloc(entries, entry_space * sizeof(*entries));
+			if(grown == NULL)
+			{
+				break;
+			}
+			entries = grown;
+		}
+		memcpy(entries[entry_count].name, entry->d_name, name_length + 1);
+		entries[entry_count].mtime = file_status.st_mtim.tv_sec * 1000000000LL + file_status.st_mtim.tv_nsec;
+		entries[entry_count].size = file_status.st_size;
+		total += file_status.st_size;
+		entry_count++;
+	}
+
+	if(total > compress_cache_max)
+	{
+		qsort(entries, entry_count, sizeof(*entries), compare_cache_entries);
+		for(i = 0; i < entry_count && total > compress_cache_max; i++)
+		{
+			if(unlinkat(dirfd(cache), entries[i].name, 0) == 0 || errno == ENOENT)
+			{
+				total -= entries[i].size;
+			}
+		}
+	}
+
+	free(entries);
+	closedir(cache);
+}
+/**
+ *
+ * \brief open_capture function opens the capture file for appending, a new file gets the file header
+ *
+ *
+ * \param path passes the capture file
+ *
+ * \return descriptor of the capture file
+ * \return -1 on error
+ *
+ */
+int open_capture(const char *path)
+{
+	struct stat file_status;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(fd == -1)
+	{
+		fprintf(stderr, "%s: cannot open capture %s: %s\n", prg_name, path, strerror(errno));
+		return -1;
+	}
+
+	if(fstat(fd, &file_status) == -1
+			|| (file_status.st_size == 0 && sms_write_all(fd, SMS_CAPTURE_MAGIC, SMS_CAPTURE_MAGIC_LENGTH) == -1))
+	{
+		fprintf(stderr, "%s: cannot write capture %s: %s\n", prg_name, path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+/**
+ *
+ * \brief capture_append function appends request bytes to the capture buffer
+ *
+ *
+ * \param capture passes the capture buffer
+ * \param data passes the request bytes
+ * \param length passes the number of bytes
+ *
+ * \return 0 when no error occurs
+ * \return -1 if no memory is left (the request is not captured)
+ *
+ */
+int capture_append(struct capture_buffer *capture, const char *data, size_t length)
+{
+	char *grown;
+	size_t size = (capture->size == 0) ? CHUNK_SIZE : capture->size;
+
+	while(size - capture->length < length)
+	{
+		size = size * 2;
+	}
+	if(size != capture->size)
+	{
+		grown = realloc(capture->data, size);
+		if(grown == NULL)
+		{
+			return -1;
+		}
+		capture->data = grown;
+		capture->size = size;
+	}
+
+	memcpy(capture->data + capture->length, data, length);
+	capture->length += length;
+	return 0;
+}
+/**
+ *
+ * \brief capture_limited function appends request bytes to the capture buffer up to capture_max bytes
+ *
+ *
+ * \param capture passes the capture buffer
+ * \param data passes the request bytes
+ * \param length passes the number of bytes
+ * \param original_length passes the number of request bytes seen so far, returns it including these
+ *
+ * \return 0 when no error occurs (bytes beyond the limit are dropped)
+ * \return -1 if no memory is left (the request is not captured)
+ *
+ */
+int capture_limited(struct capture_buffer *capture, const char *data, size_t length, uint64_t *original_length)
+{
+	size_t kept = length;
+
+	*original_length += length;
+	if(capture->length >= (size_t) capture_max)
+	{
+		return 0;
+	}
+	if(kept > (size_t) capture_max - capture->length)
+	{
+		kept = (size_t) capture_max - capture->length;
+	}
+
+	return capture_append(capture, data, kept);
+}
+/**
+ *
+ * \brief write_capture_record function appends one request to the capture file
+ *
+ * The record is written with a single writev() to the O_APPEND descriptor, so records
+ * of concurrent connections do not interleave.
+ *
+ * \param arrival_ns passes the time the connection was accepted
+ * \param data passes the request bytes
+ * \param length passes the number of bytes
+ * \param original_length passes the length of the request before it was truncated
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int write_capture_record(uint64_t arrival_ns, const char *data, size_t length, uint64_t original_length)
+{
+	static const char padding[SMS_CAPTURE_ALIGN];
+	struct sms_capture_record record;
+	struct iovec vector[3];
+	ssize_t expected;
+
+	record.arrival_ns = arrival_ns;
+	record.length = length;
+	record.original_length = original_length;
+
+	vector[0].iov_base = &record;
+	vector[0].iov_len = sizeof(record);
+	vector[1].iov_base = (void *) data;
+	vector[1].iov_len = length;
+	vector[2].iov_base = (void *) padding;
+	vector[2].iov_len = SMS_CAPTURE_PADDED(length) - length;
+	expected = (ssize_t) (sizeof(record) + SMS_CAPTURE_PADDED(length));
+
+	if(writev(capture_fd, vector, 3) != expected)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief is_query function checks if a request is a query of the board index
+ *
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ *
+ * \return 1 if the request starts with "query="
+ * \return 0 if not
+ *
+ */
+int is_query(int socket_desc)
+{
+	char peek_buffer[sizeof(SMS_BOARD_QUERY_PREFIX)];
+	ssize_t bytes_peeked;
+
+	/* waits for the prefix, shorter requests are no queries */
+	do
+	{
+		bytes_peeked = recv(socket_desc, peek_buffer, strlen(SMS_BOARD_QUERY_PREFIX), MSG_PEEK | MSG_WAITALL);
+	} while(bytes_peeked == -1 && errno == EINTR);
+
+	return bytes_peeked == (ssize_t) strlen(SMS_BOARD_QUERY_PREFIX)
+			&& memcmp(peek_buffer, SMS_BOARD_QUERY_PREFIX, strlen(SMS_BOARD_QUERY_PREFIX)) == 0;
+}
+/**
+ *
+ * \brief answer_query function sends a page of board entries to the client
+ *
+ * The request line is "query=since=<id>&limit=<n>[&format=binary]". The entries after
+ * <id> are looked up in the board index, so only the index entries of the first and the
+ * last entry of the page and the page itself are read. The page is sent as a text file
+ * (send_board_page()) or as a binary snapshot.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int answer_query(int socket_desc)
+{
+	static struct request_header header;
+	struct sms_board_index first;
+	struct sms_board_index last;
+	struct stat file_status;
+	char path[PATH_MAX];
+	char line[HEADER_SIZE];
+	char *parameter;
+	char *save_ptr;
+	char *end_ptr;
+	unsigned long long since = 0;
+	unsigned long long total = 0;
+	unsigned long long count = 0;
+	unsigned long limit = BOARD_LIMIT_DEFAULT;
+	uint64_t offset = 0;
+	uint64_t length = 0;
+	off_t send_offset;
+	ssize_t bytes_sent;
+	size_t line_length;
+	int binary = 0;
+	int index_fd;
+	int log_fd = -1;
+	int valid = 1;
+
+	header.socket_desc = socket_desc;
+	header.length = 0;
+	header.position = 0;
+
+	parameter = next_header_line(&header, &line_length);
+	if(parameter == NULL)
+	{
+		valid = 0;
+	}
+	else
+	{
+		parameter[line_length - 1] = '\0';
+		if(line_length > 1 && parameter[line_length - 2] == '\r')
+		{
+			parameter[line_length - 2] = '\0';
+		}
+		parameter += strlen(SMS_BOARD_QUERY_PREFIX);
+	}
+
+	for(parameter = valid ? strtok_r(parameter, "&", &save_ptr) : NULL; parameter != NULL;
+			parameter = strtok_r(NULL, "&", &save_ptr))
+	{
+		errno = 0;
+		if(strncmp(parameter, "since=", strlen("since=")) == 0)
+		{
+			since = strtoull(parameter + strlen("since="), &end_ptr, STRTOL_BASE);
+			valid = valid && errno == 0 && *end_ptr == '\0' && end_ptr != parameter + strlen("since=");
+		}
+		else if(strncmp(parameter, "limit=", strlen("limit=")) == 0)
+		{
+			limit = strtoul(parameter + strlen("limit="), &end_ptr, STRTOL_BASE);
+			valid = valid && errno == 0 && *end_ptr == '\0' && limit > 0 && limit <= BOARD_LIMIT_MAX;
+		}
+		else if(strcmp(parameter, "format=binary") == 0)
+		{
+			binary = 1;
+		}
+		else if(strcmp(parameter, "format=text") != 0)
+		{
+			valid = 0;
+		}
+	}
+	if(!valid)
+	{
+		sms_write_all(socket_desc, INVALID_REQUEST_RESPONSE, strlen(INVALID_REQUEST_RESPONSE));
+		return -1;
+	}
+
+	/* no index yet - nothing has been posted */
+	snprintf(path, sizeof(path), "%s/%s", board_dir, SMS_BOARD_INDEX);
+	index_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(index_fd != -1 && fstat(index_fd, &file_status) == 0)
+	{
+		total = (unsigned long long) file_status.st_size / sizeof(struct sms_board_index);
+	}
+	count = (since < total) ? total - since : 0;
+	count = (count < limit) ? count : limit;
+
+	/* entries of the page are stored one after the other in the log */
+	if(count > 0)
+	{
+		if(pread(index_fd, &first, sizeof(first), (off_t) (since * sizeof(first))) != (ssize_t) sizeof(first)
+				|| pread(index_fd, &last, sizeof(last), (off_t) ((since + count - 1) * sizeof(last))) != (ssize_t) sizeof(last))
+		{
+			fprintf(stderr, "%s: cannot read board index %s\n", prg_name, strerror(errno));
+			close(index_fd);
+			return -1;
+		}
+		offset = first.offset;
+		length = last.offset + last.length - first.offset;
+
+		snprintf(path, sizeof(path), "%s/%s", board_dir, SMS_BOARD_LOG);
+		log_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(log_fd == -1)
+		{
+			fprintf(stderr, "%s: cannot open board log %s\n", prg_name, strerror(errno));
+			close(index_fd);
+			return -1;
+		}
+	}
+	if(index_fd != -1)
+	{
+		close(index_fd);
+	}
+
+	if(binary)
+	{
+		/* snapshot: the entries are sent as stored */
+		line_length = (size_t) snprintf(line, sizeof(line), "status=0\nfile=%s\n%s%llu\n%s", SMS_BOARD_SNAPSHOT_FILE,
+				LEN_PREFIX, (unsigned long long) (SMS_BOARD_MAGIC_LENGTH + length), SMS_BOARD_MAGIC);
+		if(sms_write_all(socket_desc, line, line_length) == -1)
+		{
+			valid = 0;
+		}
+		for(send_offset = (off_t) offset; valid && send_offset < (off_t) (offset + length); )
+		{
+			bytes_sent = sendfile(socket_desc, log_fd, &send_offset, (size_t) (offset + length - (uint64_t) send_offset));
+			if(bytes_sent <= 0)
+			{
+				valid = 0;
+			}
+		}
+	}
+	else
+	{
+		if(send_board_page(socket_desc, log_fd, offset, length) == -1)
+		{
+			valid = 0;
+		}
+	}
+
+	if(log_fd != -1)
+	{
+		close(log_fd);
+	}
+	if(!valid)
+	{
+		fprintf(stderr, "%s: cannot send board page %s\n", prg_name, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief send_board_page function sends board entries as a text file
+ *
+ * Every entry is sent as id=, user=, img= (if any) and len= lines, the message and a
+ * newline. The length of the file is computed from the entry headers first, then the
+ * entries are sent one at a time with the messages going directly from the log
+ * (sendfile()), so a page is never held in memory.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ * \param log_fd passes the board log
+ * \param offset passes the position of the first entry in the log
+ * \param length passes the length of the entries in the log
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int send_board_page(int socket_desc, int log_fd, uint64_t offset, uint64_t length)
+{
+	static char strings[2 * HEADER_SIZE];
+	static char lines[3 * HEADER_SIZE];
+	struct sms_board_entry entry;
+	unsigned long long page_length = 0;
+	uint64_t position;
+	off_t send_offset;
+	ssize_t bytes_sent;
+	size_t line_length;
+	size_t strings_length;
+
+	/* first pass: the len= line of the file comes before the entries */
+	for(position = offset; position < offset + length; position += SMS_BOARD_PADDED(sizeof(entry)
+			+ entry.user_length + entry.image_length + entry.message_length))
+	{
+		if(pread(log_fd, &entry, sizeof(entry), (off_t) position) != (ssize_t) sizeof(entry)
+				|| (uint64_t) entry.user_length + entry.image_length > sizeof(strings))
+		{
+			return -1;
+		}
+		page_length += (unsigned long long) snprintf(NULL, 0, "id=%llu\nuser=\n%s%llu\n\n", (unsigned long long) entry.id,
+				LEN_PREFIX, (unsigned long long) entry.message_length) + entry.user_length + entry.message_length;
+		if(entry.image_length > 0)
+		{
+			page_length += strlen("img=\n") + entry.image_length;
+		}
+	}
+
+	line_length = (size_t) snprintf(lines, sizeof(lines), "status=0\nfile=%s\n%s%llu\n", SMS_BOARD_PAGE_FILE,
+			LEN_PREFIX, page_length);
+	if(sms_write_all(socket_desc, lines, line_length) == -1)
+	{
+		return -1;
+	}
+
+	for(position = offset; position < offset + length; position += SMS_BOARD_PADDED(sizeof(entry)
+			+ entry.user_length + entry.image_length + entry.message_length))
+	{
+		if(pread(log_fd, &entry, sizeof(entry), (off_t) position) != (ssize_t) sizeof(entry)
+				|| (uint64_t) entry.user_length + entry.image_length > sizeof(strings))
+		{
+			return -1;
+		}
+		strings_length = entry.user_length + entry.image_length;
+		if(pread(log_fd, strings, strings_length, (off_t) (position + sizeof(entry))) != (ssize_t) strings_length)
+		{
+			return -1;
+		}
+		line_length = (size_t) snprintf(lines, sizeof(lines), "id=%llu\nuser=%.*s\n", (unsigned long long) entry.id,
+				(int) entry.user_length, strings);
+		if(entry.image_length > 0)
+		{
+			line_length += (size_t) snprintf(lines + line_length, sizeof(lines) - line_length, "img=%.*s\n",
+					(int) entry.image_length, strings + entry.user_length);
+		}
+		line_length += (size_t) snprintf(lines + line_length, sizeof(lines) - line_length, "%s%llu\n", LEN_PREFIX,
+				(unsigned long long) entry.message_length);
+		if(sms_write_all(socket_desc, lines, line_length) == -1)
+		{
+			return -1;
+		}
+		for(send_offset = (off_t) (position + sizeof(entry) + strings_length);
+				send_offset < (off_t) (position + sizeof(entry) + strings_length + entry.message_length); )
+		{
+			bytes_sent = sendfile(socket_desc, log_fd, &send_offset,
+					(size_t) (position + sizeof(entry) + strings_length + entry.message_length - (uint64_t) send_offset));
+			if(bytes_sent <= 0)
+			{
+				return -1;
+			}
+		}
+		if(sms_write_all(socket_desc, "\n", 1) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief board_append function adds a post to the board log and index
+ *
+ * The post is taken from the request relayed to the business logic: the user line, an
+ * optional img= line and the message. Writers are serialized by a lock on the index;
+ * the entry is written to the log before the index refers to it, so readers need no lock.
+ *
+ * \param posted_ns passes the time the connection was accepted
+ * \param request passes the request as relayed to the business logic
+ * \param length passes the length of the request
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int board_append(uint64_t posted_ns, const char *request, size_t length)
+{
+	static const char padding[SMS_BOARD_ALIGN];
+	struct sms_board_entry entry;
+	struct sms_board_index index_entry;
+	struct stat file_status;
+	struct iovec parts[5];
+	char path[PATH_MAX];
+	const char *user;
+	const char *image = "";
+	const char *message;
+	const char *line_end;
+	size_t message_length;
+	int index_fd;
+	int log_fd;
+	int check = -1;
 
+	/* user=<name>\n[img=<url>\n]<message>\n */
+	line_end = memchr(request, '\n', length);
+	if(line_end == NULL || length < strlen(USER_PREFIX) || strncmp(request, USER_PREFIX, strlen(USER_PREFIX)) != 0)
+	{
+		return 0;
+	}
+	user = request + strlen(USER_PREFIX);
+	entry.user_length = (uint32_t) (line_end - user);
+	message = line_end + 1;
+	entry.image_length = 0;
+	line_end = memchr(message, '\n', length - (size_t) (message - request));
+	if(line_end != NULL && strncmp(message, "img=", strlen("img=")) == 0)
+	{
+		image = message + strlen("img=");
+		entry.image_length = (uint32_t) (line_end - image);
+		message = line_end + 1;
+	}
+	message_length = length - (size_t) (message - request);
+	if(message_length > 0 && message[message_length - 1] == '\n')
+	{
+		message_length--;
+	}
+	entry.message_length = message_length;
+	entry.posted_ns = posted_ns;
 
-/*
- * ---------------------------------- function prototypes ------------
- */
+	snprintf(path, sizeof(path), "%s/%s", board_dir, SMS_BOARD_INDEX);
+	index_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(index_fd == -1)
+	{
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/%s", board_dir, SMS_BOARD_LOG);
+	log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(log_fd == -1)
+	{
+		close(index_fd);
+		return -1;
+	}
 
-void my_usage(FILE * out, int exit_status);
-void check_parameters_server(int argc, char *argv[], const char **port);
-void signal_child(int sig);
+	/* the next ID and the end of the log do not change while the lock is held */
+	if(flock(index_fd, LOCK_EX) == 0 && fstat(index_fd, &file_status) == 0)
+	{
+		entry.id = (uint64_t) file_status.st_size / sizeof(index_entry) + 1;
+		index_entry.length = SMS_BOARD_PADDED(sizeof(entry) + entry.user_length + entry.image_length + message_length);
+		if(fstat(log_fd, &file_status) == 0)
+		{
+			index_entry.offset = (uint64_t) file_status.st_size;
+
+			parts[0].iov_base = &entry;
+			parts[0].iov_len = sizeof(entry);
+			parts[1].iov_base = (void *) user;
+			parts[1].iov_len = entry.user_length;
+			parts[2].iov_base = (void *) image;
+			parts[2].iov_len = entry.image_length;
+			parts[3].iov_base = (void *) message;
+			parts[3].iov_len = message_length;
+			parts[4].iov_base = (void *) padding;
+			parts[4].iov_len = index_entry.length - (sizeof(entry) + entry.user_length + entry.image_length + message_length);
+
+			if(writev(log_fd, parts, 5) == (ssize_t) index_entry.length
+					&& write(index_fd, &index_entry, sizeof(index_entry)) == (ssize_t) sizeof(index_entry))
+			{
+				check = 0;
+			}
+		}
+	}
 
+	close(log_fd);
+	/* closing releases the lock */
+	close(index_fd);
 
+	return check;
+}
 /**
  *
- * \brief Main function implements a server which connects to a client
- * Main entry point
+ * \brief board_append_post function adds the post passed through the post pipe to the board index
  *
- * \param argc passes the number of arguments
- * \param argv passes the arguments (programme name is argv[0]
+ * The post pipe carries the arrival time and the request bytes. It is read until the
+ * request relay closes it, which happens once the request is complete.
  *
- * \return EXIT_SUCCESS when no error occurred
- * \return EXIT_FAILURE when an error occurred
+ * \param post_desc passes the read end of the post pipe
+ *
+ * \return 0 when no error occurs (also if the relay passed no post)
+ * \return -1 on error
  *
  */
-
-int main(int argc, char *argv[])
+int board_append_post(int post_desc)
 {
+	static char chunk[CHUNK_SIZE];
+	struct capture_buffer post = { NULL, 0, 0 };
+	uint64_t posted_ns;
+	ssize_t bytes_read;
+	int check = 0;
 
-	struct addrinfo hints;
-	struct addrinfo *server, *rp;
-	int socket_desc, new_socket_desc;
-	int check;
-	int child;
-	struct sockaddr_storage address;
-	socklen_t address_length;
-	/* server port number */
-	const char *port = NULL;
-	int y = 0;
+	do
+	{
+		bytes_read = read(post_desc, chunk, sizeof(chunk));
+		if(bytes_read > 0 && capture_append(&post, chunk, (size_t) bytes_read) == -1)
+		{
+			free(post.data);
+			return -1;
+		}
+	} while(bytes_read > 0 || (bytes_read == -1 && errno == EINTR));
 
-	prg_name = argv[0];
-	check_parameters_server(argc, argv, &port);
+	if(bytes_read == 0 && post.length >= sizeof(posted_ns))
+	{
+		memcpy(&posted_ns, post.data, sizeof(posted_ns));
+		check = board_append(posted_ns, post.data + sizeof(posted_ns), post.length - sizeof(posted_ns));
+	}
+	else if(bytes_read == -1)
+	{
+		check = -1;
+	}
+	free(post.data);
 
-	memset(&hints, 0, sizeof(hints));
-	/* server connects to IPv4 address only */
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
+	return check;
+}
+/**
+ *
+ * \brief init_placement function reads the CPUs the server may use and their NUMA nodes
+ *
+ * The node is read for every CPU in sysfs, not only for the allowed ones, as the CPU
+ * that received a connection may be outside the affinity mask of the server. CPUs that
+ * are not in sysfs have node -1.
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error
+ *
+ */
+int init_placement(void)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	struct dirent *cpu_entry;
+	DIR *directory;
+	DIR *cpus;
+	char suffix;
+	int cpu;
+	int node;
 
-	y = 1;
+	if(sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == -1)
+	{
+		fprintf(stderr, "%s: sched_getaffinity failed: %s\n", prg_name, strerror(errno));
+		return -1;
+	}
 
-	/* retrieves information of addresses that the server may connect to */
-	check = getaddrinfo(NULL, port, &hints, &server);
-	if(check != 0)
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
 	{
-		/* if gettaddrinfo fails, the according error code is printed with gai_strerror */
-		fprintf(stderr, "%s: error getaddrinfo: %s\n", prg_name, gai_strerror(check));
-		return EXIT_FAILURE;
+		cpu_node[cpu] = -1;
 	}
 
-	for (rp = server; rp != NULL; rp = rp->ai_next)
+	/* the node of a CPU is the nodeN entry in its sysfs directory, node 0 without NUMA support */
+	cpus = opendir(SYSFS_CPU);
+	if(cpus == NULL)
 	{
-		/* retrieve socket descriptor for connection */
-		socket_desc = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
-		if(socket_desc == -1)
+		fprintf(stderr, "%s: cannot read %s: %s\n", prg_name, SYSFS_CPU, strerror(errno));
+	}
+	while(cpus != NULL && (cpu_entry = readdir(cpus)) != NULL)
+	{
+		/* cpuN only, not cpufreq, cpuidle and the like */
+		if(sscanf(cpu_entry->d_name, "cpu%d%c", &cpu, &suffix) != 1 || cpu < 0 || cpu >= CPU_SETSIZE)
 		{
-			fprintf(stderr, "%s: error socket: %s\n", prg_name, strerror(errno));
-			freeaddrinfo(server);
-			return EXIT_FAILURE;
+			continue;
 		}
-
-		/* socket options are set on API Level (SOL_SOCKET), and optval is nonzero as to enable boolean option; optlen is sizeof int */
-		if(setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(int)) == -1)
+		snprintf(path, sizeof(path), SYSFS_CPU "/%s", cpu_entry->d_name);
+		directory = opendir(path);
+		if(directory == NULL)
 		{
-			fprintf(stderr, "%s: error setsockopt %s\n", prg_name, strerror(errno));
-			close(socket_desc);
-			freeaddrinfo(server);
-			return EXIT_FAILURE;
+			continue;
 		}
-		/* if bind is not successful, try with the next address */
-		if(bind(socket_desc, server->ai_addr, server->ai_addrlen) == -1)
+		cpu_node[cpu] = 0;
+		while((entry = readdir(directory)) != NULL)
 		{
-			fprintf(stderr, "%s: error bind %s\n", prg_name, strerror(errno));
-			close(socket_desc);
-			freeaddrinfo(server);
-			continue;
+			if(sscanf(entry->d_name, "node%d", &node) == 1)
+			{
+				cpu_node[cpu] = node;
+				if(node + 1 > numa_nodes)
+				{
+					numa_nodes = node + 1;
+				}
+				break;
+			}
 		}
-		break;
+		closedir(directory);
+	}
+	if(cpus != NULL)
+	{
+		closedir(cpus);
 	}
 
-	if(rp == NULL)
+	if(placement_path != NULL)
 	{
-		fprintf(stderr, "%s: server binding failed\n", prg_name);
-		return EXIT_FAILURE;
+		placement_fd = open(placement_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if(placement_fd == -1)
+		{
+			fprintf(stderr, "%s: cannot open placement report %s: %s\n", prg_name, placement_path, strerror(errno));
+			return -1;
+		}
 	}
 
-	freeaddrinfo(server);
+	return 0;
+}
+/**
+ *
+ * \brief choose_cpu function chooses the CPU the worker of a connection runs on
+ *
+ * roundrobin takes the allowed CPUs in turn. incoming takes the CPU that processed the
+ * packets of the connection (SO_INCOMING_CPU), so socket buffers and the worker share
+ * caches and NUMA node; if the kernel does not know it, roundrobin is used.
+ *
+ * \param socket_desc passes the accepted socket descriptor
+ * \param incoming_cpu returns the CPU that received the connection, -1 if unknown
+ *
+ * \return the CPU for the worker
+ * \return -1 if the worker is not pinned (policy none)
+ *
+ */
+int choose_cpu(int socket_desc, int *incoming_cpu)
+{
+	socklen_t option_length = sizeof(*incoming_cpu);
+	int cpu;
 
-	/* listen on socket */
-	if(listen(socket_desc, LISTEN) == -1)
+	*incoming_cpu = -1;
+	if(getsockopt(socket_desc, SOL_SOCKET, SO_INCOMING_CPU, incoming_cpu, &option_length) == -1
+			|| *incoming_cpu < 0 || *incoming_cpu >= CPU_SETSIZE)
 	{
-		fprintf(stderr, "%s: error because of too many connections %s\n", prg_name, strerror(errno));
-		close(socket_desc);
-		return EXIT_FAILURE;
+		*incoming_cpu = -1;
 	}
 
-	/* parent is not informed when child terminates and zombie state is not possible */
-	signal(SIGCHLD, signal_child);
-
-	/* loop until accept was successful */
-	for(;;)
+	if(cpu_policy == CPU_POLICY_NONE)
 	{
-		address_length = sizeof(address);
-		new_socket_desc = accept(socket_desc, (struct sockaddr *) &address, &address_length);
+		return -1;
+	}
+	if(cpu_policy == CPU_POLICY_INCOMING && *incoming_cpu != -1 && CPU_ISSET(*incoming_cpu, &allowed_cpus))
+	{
+		return *incoming_cpu;
+	}
 
-		/* error handling for accept */
-		if(new_socket_desc == -1)
-		{
-			/* if the system call was interrupted by a signal that was caught before a valid connection was
-			 * established, continue */
-			if(errno == EINTR)
-			{
-				continue;
-			}
-			else
-			{
-				fprintf(stderr, "%s: error accept %s\n", prg_name, strerror(errno));
-				close(socket_desc);
-				return EXIT_FAILURE;
-			}
-		}
+	for(cpu = next_cpu; !CPU_ISSET(cpu, &allowed_cpus); cpu = (cpu + 1) % CPU_SETSIZE)
+	{
+		/* skip CPUs the server must not use */
+	}
+	next_cpu = (cpu + 1) % CPU_SETSIZE;
 
-		/* fork child process for execution of business logic */
-		child = fork();
+	return cpu;
+}
+/**
+ *
+ * \brief place_worker function pins the worker to its CPU and prefers memory of the local NUMA node
+ *
+ * CPU affinity and memory policy are kept across execlp(), so they apply to the business
+ * logic as well. A line with the placement is appended to the placement report:
+ * pid, policy, cpu, node, incoming_cpu and incoming_node (-1 if not known).
+ *
+ * \param cpu passes the CPU chosen by choose_cpu(), -1 to leave the worker where it is
+ * \param incoming_cpu passes the CPU that received the connection, -1 if unknown
+ *
+ */
+void place_worker(int cpu, int incoming_cpu)
+{
+	static const char *policy_names[] = { "none", "roundrobin", "incoming" };
+	char line[256];
+	cpu_set_t cpu_set;
+	unsigned long node_mask;
+	int line_length;
+	int node;
 
-		/* if fork failed -1 is returned */
-		if(child == -1)
+	if(cpu != -1)
+	{
+		CPU_ZERO(&cpu_set);
+		CPU_SET(cpu, &cpu_set);
+		if(sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == -1)
 		{
-			close(new_socket_desc);
-			close(socket_desc);
-			fprintf(stderr, "%s: fork error %s\n", prg_name, strerror(errno));
-			return EXIT_FAILURE;
+			fprintf(stderr, "%s: sched_setaffinity to cpu %d failed: %s\n", prg_name, cpu, strerror(errno));
 		}
-		else if(child == 0)
+
+		/* preferred instead of bound - a full node must not make the business logic fail */
+		node = cpu_node[cpu];
+		if(numa_nodes > 1 && node >= 0 && node < (int) (sizeof(node_mask) * CHAR_BIT))
 		{
-			close(socket_desc);
-			/* to replace stdin with the new socket descriptor */
-			if(dup2(new_socket_desc, 0) == -1)
-			{
-				close(new_socket_desc);
-				return EXIT_FAILURE;
-			}
-			/* to replace stdout with the new socket descriptor */
-			if(dup2(new_socket_desc, 1) == -1)
+			node_mask = 1UL << node;
+			if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * CHAR_BIT) == -1)
 			{
-				close(new_socket_desc);
-				return EXIT_FAILURE;
-			}
-			/* execute simple message server logic and terminate call of arguments with NULL */
-			if(execlp(PATHSERVERLOGIC, "simple_message_server_logic", NULL) == -1)
-			{
-				fprintf(stderr, "%s: execlp() failed: %s\n", prg_name, strerror(errno));
-				return EXIT_FAILURE;
+				fprintf(stderr, "%s: set_mempolicy to node %d failed: %s\n", prg_name, node, strerror(errno));
 			}
-			close(new_socket_desc);
 		}
-		close(new_socket_desc);
 	}
 
-	return EXIT_SUCCESS;
+	if(placement_fd == -1)
+	{
+		return;
+	}
 
+	/* where the worker actually runs after sched_setaffinity() */
+	cpu = sched_getcpu();
+	line_length = snprintf(line, sizeof(line), "pid=%ld policy=%s cpu=%d node=%d incoming_cpu=%d incoming_node=%d\n",
+			(long) getpid(), policy_names[cpu_policy], cpu, (cpu >= 0 && cpu < CPU_SETSIZE) ? cpu_node[cpu] : -1,
+			incoming_cpu, (incoming_cpu != -1) ? cpu_node[incoming_cpu] : -1);
+	/* a single write() to an O_APPEND file does not interleave with the other workers */
+	if(sms_write_all(placement_fd, line, (size_t) line_length) == -1)
+	{
+		fprintf(stderr, "%s: cannot write placement report: %s\n", prg_name, strerror(errno));
+	}
+	close(placement_fd);
+	placement_fd = -1;
 }
 /**
  *
@@ -232,6 +2744,7 @@ int main(int argc, char *argv[])
 
 void check_parameters_server(int argc, char *argv[], const char **port)
 {
+	static char image_store_url[PATH_MAX + sizeof("file:///")];
 	int j;
 	long int port_number;
 	char *end_ptr;
@@ -241,6 +2754,18 @@ void check_parameters_server(int argc, char *argv[], const char **port)
 			/* flag is NULL so val is returned
 			 * [name, has_arg, flag, val]*/
 			{"port", 1, NULL, 'p'},
+			{"handoff", 1, NULL, 'H'},
+			{"image-store", 1, NULL, 'i'},
+			{"image-url", 1, NULL, 'u'},
+			{"image-max", 1, NULL, 'm'},
+			{"capture", 1, NULL, 'c'},
+			{"capture-max", 1, NULL, 'C'},
+			{"compress", 0, NULL, 'z'},
+			{"compress-cache", 1, NULL, 'k'},
+			{"compress-cache-max", 1, NULL, 'K'},
+			{"board", 1, NULL, 'b'},
+			{"cpu-policy", 1, NULL, 'a'},
+			{"placement-report", 1, NULL, 'r'},
 			{"help", 0, NULL, 'h'},
 			/* last line of the array has to be filled with 0 */
 			{0, 0, 0, 0}
@@ -249,11 +2774,17 @@ void check_parameters_server(int argc, char *argv[], const char **port)
 	*port = NULL;
 
 
-	while ((j = getopt_long(argc, (char **const) argv, "p:h", long_options, NULL)) != -1)
+	while ((j = getopt_long(argc, (char **const) argv, "p:H:i:u:m:c:C:zk:K:b:a:r:h", long_options, NULL)) != -1)
 	{
 		switch(j)
 		{
 		case 'p':
+			/* unix domain socket instead of a port */
+			if(strncmp(optarg, SMS_UNIX_PREFIX, strlen(SMS_UNIX_PREFIX)) == 0)
+			{
+				*port = optarg;
+				break;
+			}
 			port_number = strtol(optarg, &end_ptr, STRTOL_BASE);
 
 			/* if strtol failed */
@@ -271,6 +2802,76 @@ void check_parameters_server(int argc, char *argv[], const char **port)
 			/* save port */
 			*port = optarg;
 			break;
+		case 'H':
+			handoff_path = optarg;
+			break;
+		case 'i':
+			image_store = optarg;
+			break;
+		case 'u':
+			image_url = optarg;
+			break;
+		case 'm':
+			errno = 0;
+			image_max = strtol(optarg, &end_ptr, STRTOL_BASE);
+			if(errno != 0 || end_ptr == optarg || *end_ptr != '\0' || image_max < 0)
+			{
+				fprintf(stderr, "%s: invalid image size %s\n", prg_name, optarg);
+				my_usage(stderr, EXIT_FAILURE);
+			}
+			break;
+		case 'c':
+			capture_path = optarg;
+			break;
+		case 'C':
+			errno = 0;
+			capture_max = strtol(optarg, &end_ptr, STRTOL_BASE);
+			if(errno != 0 || end_ptr == optarg || *end_ptr != '\0' || capture_max < 0)
+			{
+				fprintf(stderr, "%s: invalid capture size %s\n", prg_name, optarg);
+				my_usage(stderr, EXIT_FAILURE);
+			}
+			break;
+		case 'z':
+			compress_responses = 1;
+			break;
+		case 'k':
+			compress_cache = optarg;
+			break;
+		case 'K':
+			errno = 0;
+			compress_cache_max = strtoll(optarg, &end_ptr, STRTOL_BASE);
+			if(errno != 0 || end_ptr == optarg || *end_ptr != '\0' || compress_cache_max < 0)
+			{
+				fprintf(stderr, "%s: invalid cache size %s\n", prg_name, optarg);
+				my_usage(stderr, EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			board_dir = optarg;
+			break;
+		case 'a':
+			if(strcmp(optarg, "none") == 0)
+			{
+				cpu_policy = CPU_POLICY_NONE;
+			}
+			else if(strcmp(optarg, "roundrobin") == 0)
+			{
+				cpu_policy = CPU_POLICY_ROUNDROBIN;
+			}
+			else if(strcmp(optarg, "incoming") == 0)
+			{
+				cpu_policy = CPU_POLICY_INCOMING;
+			}
+			else
+			{
+				fprintf(stderr, "%s: unknown cpu policy %s\n", prg_name, optarg);
+				my_usage(stderr, EXIT_FAILURE);
+			}
+			break;
+		case 'r':
+			placement_path = optarg;
+			break;
 		case 'h':
 			my_usage(stdout, EXIT_SUCCESS);
 			break;
@@ -288,6 +2889,19 @@ void check_parameters_server(int argc, char *argv[], const char **port)
 	{
 		my_usage(stderr, EXIT_FAILURE);
 	}
+
+	/* stored images are referenced by file URL unless a web server URL is given */
+	if(image_store != NULL && image_url == NULL)
+	{
+		if(realpath(image_store, image_store_url + strlen("file://")) == NULL)
+		{
+			fprintf(stderr, "%s: image store %s: %s\n", prg_name, image_store, strerror(errno));
+			my_usage(stderr, EXIT_FAILURE);
+		}
+		memcpy(image_store_url, "file://", strlen("file://"));
+		strcat(image_store_url, "/");
+		image_url = image_store_url;
+	}
 }
 
 /**
@@ -322,7 +2936,26 @@ void my_usage(FILE *out, int exit_status)
 	int check;
 
 	check = fprintf(out, "usage: %s <options>\n"
-			"\t-p, \t--port <port>\n"
+			"\t-p, \t--port <port>\t\tport or unix:/path (unix:@name for abstract socket)\n"
+			"\t-H, \t--handoff <path>\tunix socket for hot restart: take over the\n"
+			"\t\t\t\t\tlistening socket of a running server\n"
+			"\t-i, \t--image-store <dir>\taccept image uploads and store them in dir\n"
+			"\t-u, \t--image-url <url>\tURL prefix of the image store (default file://<dir>/)\n"
+			"\t-m, \t--image-max <bytes>\tlargest image upload accepted (default 1048576)\n"
+			"\t-c, \t--capture <file>\trecord requests and arrival times for replay\n"
+			"\t-C, \t--capture-max <bytes>\tbytes of a request kept for --capture and --board,\n"
+			"\t\t\t\t\tlonger requests are captured truncated (default 1048576)\n"
+			"\t-z, \t--compress\t\tcompress response files for clients sending\n"
+			"\t\t\t\t\t" ACCEPT_ENCODING "\n"
+			"\t-k, \t--compress-cache <dir> keep compressed files in dir, so unchanged\n"
+			"\t\t\t\t\tfiles are compressed once\n"
+			"\t-K, \t--compress-cache-max <bytes> size dir is trimmed to, least recently\n"
+			"\t\t\t\t\tused files first (default 67108864)\n"
+			"\t-b, \t--board <dir>\t\tkeep an index of the posts in dir and answer\n"
+			"\t\t\t\t\tquery=since=<id>&limit=<n>[&format=binary] requests\n"
+			"\t-a, \t--cpu-policy <policy>\tpin workers: none, roundrobin or incoming (CPU\n"
+			"\t\t\t\t\tthat received the connection), memory of its NUMA node\n"
+			"\t-r, \t--placement-report <file> append the CPU and node of each worker to file\n"
 			"\t-h, \t--help\n", prg_name);
 	/* if fprintf to stdout fails and flush after that */
 	if(check < 0)
@@ -335,7 +2968,7 @@ void my_usage(FILE *out, int exit_status)
 	if (check != 0)
 	{
 		fprintf(stderr, "Could not flush stdout: %s", strerror(errno));
-		return EXIT_FAILURE;
+		exit(EXIT_FAILURE);
 	}
 	check = 0;
 	check = fflush(stderr);
@@ -343,7 +2976,7 @@ void my_usage(FILE *out, int exit_status)
 	if (check != 0)
 	{
 		fprintf(stderr, "Could not flush stderr: %s", strerror(errno));
-		return EXIT_FAILURE;
+		exit(EXIT_FAILURE);
 	}
 	exit(exit_status);
 }
@@ -0,0 +1,312 @@
+/**
+ * @file simple_message_socket.c
+ *
+ * VCS TCP/IP Client and Server - socket helpers shared by client and server
+ *
+ * @author: Claudia Baierl - ic14b003 <ic14b003@technikum-wien.at>
+ * @author: Zuebide Sayici - ic14b002 <ic14b002@technikum-wien.at>
+ *
+ * @version $Revision: 1 $
+ *
+ * Last Modified: $Author: Claudia Baierl $
+ */
+
+/*
+ * ----------------------------- includes -------------------------
+ */
+
+/* struct ucred */
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simple_message_socket.h"
+
+/**
+ *
+ * \brief sms_unix_address function converts a unix:/path endpoint into a unix domain socket address
+ *
+ * A leading '@' in the path selects the linux abstract namespace (unix:@name),
+ * which needs no socket file in the file system.
+ *
+ * \param endpoint passes the endpoint given on the command line
+ * \param address returns the socket address
+ * \param address_length returns the length of the socket address
+ *
+ * \return 1 if endpoint is a unix domain socket endpoint
+ * \return 0 if endpoint is no unix domain socket endpoint (i.e. a host name or port)
+ * \return -1 if the path is empty or too long
+ *
+ */
+int sms_unix_address(const char *endpoint, struct sockaddr_un *address, socklen_t *address_length)
+{
+	const char *path;
+	size_t path_length;
+
+	if(strncmp(endpoint, SMS_UNIX_PREFIX, strlen(SMS_UNIX_PREFIX)) != 0)
+	{
+		return 0;
+	}
+
+	path = endpoint + strlen(SMS_UNIX_PREFIX);
+	path_length = strlen(path);
+	/* path has to fit including terminating byte (or leading 0 byte for abstract sockets) */
+	if(path_length == 0 || path_length >= sizeof(address->sun_path))
+	{
+		return -1;
+	}
+
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, path, path_length);
+
+	if(path[0] == '@')
+	{
+		/* abstract socket: name starts with a 0 byte and is not terminated */
+		address->sun_path[0] = '\0';
+		*address_length = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + path_length);
+	}
+	else
+	{
+		*address_length = (socklen_t) sizeof(*address);
+	}
+
+	return 1;
+}
+/**
+ *
+ * \brief sms_send_fd function passes a file descriptor over a unix domain socket (SCM_RIGHTS)
+ *
+ * \param channel_desc passes the connected unix domain socket
+ * \param fd passes the descriptor to pass, the caller keeps its own copy
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error (errno is set)
+ *
+ */
+int sms_send_fd(int channel_desc, int fd)
+{
+	struct msghdr message;
+	struct iovec vector;
+	struct cmsghdr *control;
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control_buffer;
+	char dummy = 0;
+
+	memset(&message, 0, sizeof(message));
+	memset(&control_buffer, 0, sizeof(control_buffer));
+	/* at least one byte of data has to be sent with the descriptor */
+	vector.iov_base = &dummy;
+	vector.iov_len = sizeof(dummy);
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = control_buffer.buffer;
+	message.msg_controllen = sizeof(control_buffer.buffer);
+
+	control = CMSG_FIRSTHDR(&message);
+	control->cmsg_level = SOL_SOCKET;
+	control->cmsg_type = SCM_RIGHTS;
+	control->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(control), &fd, sizeof(int));
+
+	if(sendmsg(channel_desc, &message, MSG_NOSIGNAL) == -1)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief sms_receive_fd function receives a file descriptor sent with sms_send_fd()
+ *
+ * \param channel_desc passes the connected unix domain socket
+ *
+ * \return received descriptor
+ * \return -1 on error or if the message did not contain a descriptor
+ *
+ */
+int sms_receive_fd(int channel_desc)
+{
+	struct msghdr message;
+	struct iovec vector;
+	struct cmsghdr *control;
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control_buffer;
+	char dummy;
+	int fd = -1;
+
+	memset(&message, 0, sizeof(message));
+	vector.iov_base = &dummy;
+	vector.iov_len = sizeof(dummy);
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = control_buffer.buffer;
+	message.msg_controllen = sizeof(control_buffer.buffer);
+
+	if(recvmsg(channel_desc, &message, MSG_CMSG_CLOEXEC) <= 0)
+	{
+		return -1;
+	}
+
+	control = CMSG_FIRSTHDR(&message);
+	if(control != NULL && control->cmsg_level == SOL_SOCKET && control->cmsg_type == SCM_RIGHTS)
+	{
+		memcpy(&fd, CMSG_DATA(control), sizeof(int));
+	}
+
+	return fd;
+}
+/**
+ *
+ * \brief sms_write_all function writes the whole buffer
+ *
+ *
+ * \param fd passes the file descriptor
+ * \param buffer passes the data
+ * \param length passes the number of bytes
+ *
+ * \return 0 when no error occurs
+ * \return -1 on error (errno is set)
+ *
+ */
+int sms_write_all(int fd, const char *buffer, size_t length)
+{
+	ssize_t bytes_written;
+
+	while(length > 0)
+	{
+		bytes_written = write(fd, buffer, length);
+		if(bytes_written == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		buffer += bytes_written;
+		length -= (size_t) bytes_written;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief sms_peer_is_own_user function checks that the peer of a unix domain socket runs as the same user
+ *
+ * The credentials are taken from SO_PEERCRED, i.e. from the kernel, when the
+ * connection was established.
+ *
+ * \param channel_desc passes the connected unix domain socket
+ *
+ * \return 1 if the peer has the effective uid of this process
+ * \return 0 if the peer runs as another user
+ * \return -1 on error (errno is set)
+ *
+ */
+int sms_peer_is_own_user(int channel_desc)
+{
+	struct ucred credentials;
+	socklen_t length = sizeof(credentials);
+
+	if(getsockopt(channel_desc, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == -1)
+	{
+		return -1;
+	}
+
+	return (credentials.uid == geteuid()) ? 1 : 0;
+}
+/**
+ *
+ * \brief sms_remove_stale_socket function removes the socket file of a unix domain socket nobody listens on
+ *
+ * The path is only unlinked if it is a socket and a probe connect() is refused,
+ * i.e. the server that created it is gone. Other files and sockets in use are left
+ * alone. Abstract sockets have no file and are not touched.
+ *
+ * \param address passes the address that is going to be bound
+ * \param address_length passes the length of the address
+ *
+ * \return 0 if the path is free now
+ * \return -1 if the path is in use, is no socket or cannot be checked (errno is set)
+ *
+ */
+int sms_remove_stale_socket(const struct sockaddr_un *address, socklen_t address_length)
+{
+	struct stat status;
+	int probe_desc;
+	int check;
+
+	if(address->sun_path[0] == '\0')
+	{
+		return 0;
+	}
+
+	if(lstat(address->sun_path, &status) == -1)
+	{
+		return (errno == ENOENT) ? 0 : -1;
+	}
+	if(!S_ISSOCK(status.st_mode))
+	{
+		errno = ENOTSOCK;
+		return -1;
+	}
+
+	probe_desc = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(probe_desc == -1)
+	{
+		return -1;
+	}
+	check = connect(probe_desc, (const struct sockaddr *) address, address_length);
+	close(probe_desc);
+	if(check == 0)
+	{
+		errno = EADDRINUSE;
+		return -1;
+	}
+	if(errno != ECONNREFUSED)
+	{
+		return -1;
+	}
+
+	if(unlink(address->sun_path) == -1 && errno != ENOENT)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+/**
+ *
+ * \brief sms_fnv1a function continues an FNV-1a (64 bit) hash over more bytes
+ *
+ *
+ * \param hash passes the hash so far (SMS_FNV1A_OFFSET_BASIS for the first bytes)
+ * \param data passes the bytes
+ * \param length passes the number of bytes
+ *
+ * \return hash including these bytes
+ *
+ */
+uint64_t sms_fnv1a(uint64_t hash, const void *data, size_t length)
+{
+	const unsigned char *byte = data;
+	size_t i;
+
+	for(i = 0; i < length; i++)
+	{
+		hash = (hash ^ byte[i]) * 1099511628211ULL;
+	}
+
+	return hash;
+}
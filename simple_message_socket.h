@@ -0,0 +1,46 @@
+/**
+ * @file simple_message_socket.h
+ *
+ * VCS TCP/IP Client and Server - socket helpers shared by client and server
+ *
+ * @author: Claudia Baierl - ic14b003 <ic14b003@technikum-wien.at>
+ * @author: Zuebide Sayici - ic14b002 <ic14b002@technikum-wien.at>
+ *
+ * @version $Revision: 1 $
+ *
+ * Last Modified: $Author: Claudia Baierl $
+ */
+
+#ifndef SIMPLE_MESSAGE_SOCKET_H
+#define SIMPLE_MESSAGE_SOCKET_H
+
+/*
+ * ----------------------------- includes -------------------------
+ */
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * ---------------------------------- defines ------------------------
+ */
+
+/* prefix of unix domain socket endpoints, e.g. unix:/tmp/board.sock or unix:@board */
+#define SMS_UNIX_PREFIX "unix:"
+/* start value of an FNV-1a (64 bit) hash for sms_fnv1a() */
+#define SMS_FNV1A_OFFSET_BASIS 14695981039346656037ULL
+
+/*
+ * ---------------------------------- function prototypes ------------
+ */
+
+int sms_unix_address(const char *endpoint, struct sockaddr_un *address, socklen_t *address_length);
+int sms_send_fd(int channel_desc, int fd);
+int sms_receive_fd(int channel_desc);
+int sms_write_all(int fd, const char *buffer, size_t length);
+int sms_peer_is_own_user(int channel_desc);
+int sms_remove_stale_socket(const struct sockaddr_un *address, socklen_t address_length);
+uint64_t sms_fnv1a(uint64_t hash, const void *data, size_t length);
+
+#endif /* SIMPLE_MESSAGE_SOCKET_H */